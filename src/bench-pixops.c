@@ -0,0 +1,180 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
+
+#include "nd-pixops.h"
+
+/* Times the reduction of screen sized images to an icon surface, the
+ * usual case for image-path and image-data, with gdk-pixbuf followed by
+ * the conversion to a cairo surface and with the box filter, which
+ * writes the surface directly, with and without SSE2.  Then times the
+ * conversion of the full image to a cairo surface.
+ *
+ *   bench-pixops [ITERATIONS] */
+
+#define ICON_SIZE 48
+
+static GdkPixbuf *
+random_pixbuf (int      width,
+               int      height,
+               gboolean has_alpha)
+{
+        GdkPixbuf *pixbuf;
+        guchar    *pixels;
+        gsize      length;
+        gsize      i;
+
+        pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+        pixels = gdk_pixbuf_get_pixels (pixbuf);
+        length = (gsize) gdk_pixbuf_get_rowstride (pixbuf) * height;
+
+        for (i = 0; i < length; i++) {
+                pixels[i] = g_random_int_range (0, 256);
+        }
+
+        return pixbuf;
+}
+
+static double
+time_scale (GdkPixbuf *pixbuf,
+            gboolean   box_filter,
+            int        iterations)
+{
+        GTimer *timer;
+        double  elapsed;
+        int     i;
+
+        timer = g_timer_new ();
+
+        for (i = 0; i < iterations; i++) {
+                cairo_surface_t *surface;
+
+                if (box_filter) {
+                        surface = nd_pixops_scale_down (pixbuf, ICON_SIZE, ICON_SIZE);
+                } else {
+                        GdkPixbuf *scaled;
+
+                        scaled = gdk_pixbuf_scale_simple (pixbuf,
+                                                          ICON_SIZE,
+                                                          ICON_SIZE,
+                                                          GDK_INTERP_BILINEAR);
+                        surface = nd_pixops_surface_from_pixbuf (scaled);
+                        g_object_unref (scaled);
+                }
+                cairo_surface_destroy (surface);
+        }
+
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_timer_destroy (timer);
+
+        return elapsed * 1000 / iterations;
+}
+
+static double
+time_surface (GdkPixbuf *pixbuf,
+              int        iterations)
+{
+        GTimer *timer;
+        double  elapsed;
+        int     i;
+
+        timer = g_timer_new ();
+
+        for (i = 0; i < iterations; i++) {
+                cairo_surface_destroy (nd_pixops_surface_from_pixbuf (pixbuf));
+        }
+
+        elapsed = g_timer_elapsed (timer, NULL);
+        g_timer_destroy (timer);
+
+        return elapsed * 1000 / iterations;
+}
+
+static void
+run (const char *name,
+     int         width,
+     int         height,
+     gboolean    has_alpha,
+     int         iterations)
+{
+        GdkPixbuf *pixbuf;
+        double     bilinear;
+        double     simd;
+        double     scalar;
+        double     surface_simd;
+        double     surface_scalar;
+
+        pixbuf = random_pixbuf (width, height, has_alpha);
+
+        bilinear = time_scale (pixbuf, FALSE, iterations);
+
+        _nd_pixops_set_simd_enabled (TRUE);
+        simd = time_scale (pixbuf, TRUE, iterations);
+        surface_simd = time_surface (pixbuf, iterations);
+
+        _nd_pixops_set_simd_enabled (FALSE);
+        scalar = time_scale (pixbuf, TRUE, iterations);
+        surface_scalar = time_surface (pixbuf, iterations);
+
+        _nd_pixops_set_simd_enabled (TRUE);
+
+        g_print ("%-10s %-4s  bilinear %8.2f ms  box %8.2f ms  box (scalar) %8.2f ms  "
+                 "surface %8.2f ms  surface (scalar) %8.2f ms\n",
+                 name,
+                 has_alpha ? "RGBA" : "RGB",
+                 bilinear,
+                 simd,
+                 scalar,
+                 surface_simd,
+                 surface_scalar);
+
+        g_object_unref (pixbuf);
+}
+
+int
+main (int argc, char **argv)
+{
+        int iterations;
+
+        g_type_init ();
+
+        iterations = argc > 1 ? atoi (argv[1]) : 10;
+        if (iterations <= 0) {
+                g_printerr ("Usage: %s [ITERATIONS]\n", argv[0]);
+                return 1;
+        }
+
+        /* the same source for every run */
+        g_random_set_seed (42);
+
+        run ("3840x2160", 3840, 2160, FALSE, iterations);
+        run ("3840x2160", 3840, 2160, TRUE, iterations);
+        run ("1920x1080", 1920, 1080, FALSE, iterations);
+        run ("1920x1080", 1920, 1080, TRUE, iterations);
+
+        return 0;
+}
@@ -26,10 +26,16 @@
 #include <errno.h>
 #include <string.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <glib/gi18n.h>
 #include <glib.h>
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <glib-object.h>
 #include <gtk/gtk.h>
 
@@ -41,10 +47,25 @@
 #include <gdk/gdkx.h>
 
 #include "daemon.h"
+#include "nd-image-cache.h"
 #include "nd-notification.h"
 #include "nd-queue.h"
+#include "nd-rate-limiter.h"
 
-#define MAX_NOTIFICATIONS 20
+/* Hard cap on stored notifications.  Flood control for individual
+   clients is done by the per-sender rate limiter. */
+#define MAX_NOTIFICATIONS 1000
+
+/* Monitoring agents post dozens of notifications per second and chat
+   clients burst on reconnect, so a sender is only throttled well past
+   that.  A runaway client alone still needs some 18 seconds to fill
+   the queue. */
+#define DEFAULT_RATE_LIMIT       50.0
+#define DEFAULT_RATE_LIMIT_BURST 100
+
+/* Notify calls carrying large image hints cost an extra token per
+   this many bytes of message body. */
+#define RATE_LIMIT_BYTES_PER_TOKEN (8 * 1024 * 1024)
 
 #define IDLE_SECONDS 30
 #define NOTIFICATION_BUS_NAME      "org.freedesktop.Notifications"
@@ -52,16 +73,41 @@
 
 #define NOTIFICATION_SPEC_VERSION  "1.2"
 
+/* image-fd hints are only accepted when the kernel can prove that the
+   client can no longer modify or truncate the shared memory */
+#ifdef F_GET_SEALS
+#define HAVE_IMAGE_FD 1
+#endif
+
+/* largest image an image-fd hint may describe */
+#define MAX_IMAGE_FD_SIZE (64 * 1024 * 1024)
+
 #define NW_GET_DAEMON(nw) \
         (g_object_get_data(G_OBJECT(nw), "_notify_daemon"))
+#define NW_GET_CONNECTION(nw) \
+        (g_object_get_data(G_OBJECT(nw), "_notify_connection"))
+#define CONNECTION_GET_PEER_NAME(c) \
+        (g_object_get_data(G_OBJECT(c), "_notify_peer_name"))
 
 struct _NotifyDaemonPrivate
 {
         GDBusConnection *connection;
         NdQueue         *queue;
+        NdRateLimiter   *rate_limiter;
+        GHashTable      *senders;
+        GDBusServer     *server;
+        char            *server_path;
 };
 
+/* One bus name watch per client that has live notifications */
+typedef struct
+{
+        guint            watch_id;
+        guint            n_notifications;
+} SenderWatch;
+
 static void notify_daemon_finalize (GObject *object);
+static void free_sender_watch      (SenderWatch *watch);
 
 G_DEFINE_TYPE (NotifyDaemon, notify_daemon, G_TYPE_OBJECT);
 
@@ -83,6 +129,10 @@ notify_daemon_init (NotifyDaemon *daemon)
                                                     NotifyDaemonPrivate);
 
         daemon->priv->queue = nd_queue_new ();
+        daemon->priv->senders = g_hash_table_new_full (g_str_hash,
+                                                       g_str_equal,
+                                                       g_free,
+                                                       (GDestroyNotify) free_sender_watch);
 }
 
 static void
@@ -92,7 +142,19 @@ notify_daemon_finalize (GObject *object)
 
         daemon = NOTIFY_DAEMON (object);
 
+        if (daemon->priv->server != NULL) {
+                g_dbus_server_stop (daemon->priv->server);
+                g_object_unref (daemon->priv->server);
+        }
+
+        if (daemon->priv->server_path != NULL) {
+                unlink (daemon->priv->server_path);
+                g_free (daemon->priv->server_path);
+        }
+
+        g_hash_table_destroy (daemon->priv->senders);
         g_object_unref (daemon->priv->queue);
+        nd_rate_limiter_free (daemon->priv->rate_limiter);
 
         g_free (daemon->priv);
 
@@ -100,31 +162,176 @@ notify_daemon_finalize (GObject *object)
 }
 
 static void
-on_notification_close (NdNotification *notification,
-                       int             reason,
-                       NotifyDaemon   *daemon)
+free_sender_watch (SenderWatch *watch)
+{
+        if (watch->watch_id != 0) {
+                g_bus_unwatch_name (watch->watch_id);
+        }
+        g_free (watch);
+}
+
+static void
+drop_sender (NotifyDaemon *daemon,
+             const char   *name)
+{
+        char *sender;
+
+        /* removing the watch below may free name */
+        sender = g_strdup (name);
+
+        g_debug ("Sender %s vanished, dropping its notifications", sender);
+
+        /* without a watch entry, on_notification_close() won't emit
+           signals to the dead name anymore */
+        g_hash_table_remove (daemon->priv->senders, sender);
+        nd_rate_limiter_forget (daemon->priv->rate_limiter, sender);
+        nd_queue_remove_for_sender (daemon->priv->queue, sender);
+
+        g_free (sender);
+}
+
+static void
+on_sender_vanished (GDBusConnection *connection,
+                    const char      *name,
+                    gpointer         user_data)
+{
+        drop_sender (NOTIFY_DAEMON (user_data), name);
+}
+
+/* Clients on the bus are identified by their unique name, peer to
+   peer clients by a name made up when they connected. */
+static const char *
+get_client_name (GDBusConnection *connection,
+                 const char      *sender)
+{
+        if (sender != NULL) {
+                return sender;
+        }
+
+        return CONNECTION_GET_PEER_NAME (connection);
+}
+
+static void
+watch_sender (NotifyDaemon    *daemon,
+              GDBusConnection *connection,
+              const char      *sender)
+{
+        SenderWatch *watch;
+
+        if (sender == NULL) {
+                return;
+        }
+
+        watch = g_hash_table_lookup (daemon->priv->senders, sender);
+        if (watch == NULL) {
+                watch = g_new0 (SenderWatch, 1);
+                g_hash_table_insert (daemon->priv->senders, g_strdup (sender), watch);
+
+                /* peer connections report their end through "closed" */
+                if (g_dbus_connection_get_unique_name (connection) != NULL) {
+                        watch->watch_id = g_bus_watch_name_on_connection (connection,
+                                                                          sender,
+                                                                          G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                                          NULL,
+                                                                          on_sender_vanished,
+                                                                          daemon,
+                                                                          NULL);
+                }
+        }
+
+        watch->n_notifications++;
+}
+
+static void
+release_sender (NotifyDaemon *daemon,
+                const char   *sender)
+{
+        SenderWatch *watch;
+
+        if (sender == NULL) {
+                return;
+        }
+
+        watch = g_hash_table_lookup (daemon->priv->senders, sender);
+        if (watch == NULL) {
+                return;
+        }
+
+        watch->n_notifications--;
+        if (watch->n_notifications == 0) {
+                g_hash_table_remove (daemon->priv->senders, sender);
+        }
+}
+
+static gboolean
+sender_is_alive (NotifyDaemon   *daemon,
+                 NdNotification *notification)
+{
+        const char *sender;
+
+        sender = nd_notification_get_sender (notification);
+
+        return sender != NULL
+                && g_hash_table_lookup (daemon->priv->senders, sender) != NULL;
+}
+
+/* Signals go back over the connection the notification came in on.
+ * Peer connections have a single recipient, so they are not
+ * addressed. */
+static void
+emit_notification_signal (NdNotification *notification,
+                          const char     *signal_name,
+                          GVariant       *parameters)
 {
-        g_dbus_connection_emit_signal (daemon->priv->connection,
-                                       nd_notification_get_sender (notification),
+        GDBusConnection *connection;
+        const char      *destination;
+
+        connection = NW_GET_CONNECTION (notification);
+
+        destination = NULL;
+        if (g_dbus_connection_get_unique_name (connection) != NULL) {
+                destination = nd_notification_get_sender (notification);
+        }
+
+        g_dbus_connection_emit_signal (connection,
+                                       destination,
                                        "/org/freedesktop/Notifications",
                                        "org.freedesktop.Notifications",
-                                       "NotificationClosed",
-                                       g_variant_new ("(uu)", nd_notification_get_id (notification), reason),
+                                       signal_name,
+                                       parameters,
                                        NULL);
 }
 
+static void
+on_notification_close (NdNotification *notification,
+                       int             reason,
+                       NotifyDaemon   *daemon)
+{
+        if (! sender_is_alive (daemon, notification)) {
+                return;
+        }
+
+        emit_notification_signal (notification,
+                                  "NotificationClosed",
+                                  g_variant_new ("(uu)", nd_notification_get_id (notification), reason));
+
+        /* the notification can be closed again by a bubble that is
+           still showing, only count the first time */
+        if (! nd_notification_get_is_closed (notification)) {
+                release_sender (daemon, nd_notification_get_sender (notification));
+        }
+}
+
 static void
 on_notification_action_invoked (NdNotification *notification,
                                 const char     *action,
                                 NotifyDaemon   *daemon)
 {
-        g_dbus_connection_emit_signal (daemon->priv->connection,
-                                       nd_notification_get_sender (notification),
-                                       "/org/freedesktop/Notifications",
-                                       "org.freedesktop.Notifications",
-                                       "ActionInvoked",
-                                       g_variant_new ("(us)", nd_notification_get_id (notification), action),
-                                       NULL);
+        if (sender_is_alive (daemon, notification)) {
+                emit_notification_signal (notification,
+                                          "ActionInvoked",
+                                          g_variant_new ("(us)", nd_notification_get_id (notification), action));
+        }
 
         /* resident notifications don't close when actions are invoked */
         if (! nd_notification_get_is_resident (notification)) {
@@ -151,6 +358,10 @@ static const char introspection_xml[] =
         "      <arg type='i' name='timeout' direction='in' />"
         "      <arg type='u' name='return_id' direction='out' />"
         "    </method>"
+        "    <method name='NotifyBatch'>"
+        "      <arg type='a(susssasa{sv}i)' name='notifications' direction='in' />"
+        "      <arg type='au' name='return_ids' direction='out' />"
+        "    </method>"
         "    <method name='CloseNotification'>"
         "      <arg type='u' name='id' direction='in' />"
         "    </method>"
@@ -164,13 +375,236 @@ static const char introspection_xml[] =
         "      <arg type='s' name='return_spec_version' direction='out'/>"
         "    </method>"
         "  </interface>"
+        "  <interface name='org.gnome.NotificationDaemon'>"
+        "    <method name='GetPeerAddress'>"
+        "      <arg type='s' name='address' direction='out'/>"
+        "    </method>"
+        "    <method name='GetDebugInfo'>"
+        "      <arg type='a{sv}' name='info' direction='out'/>"
+        "    </method>"
+        "  </interface>"
         "</node>";
 
 static void
-handle_notify (NotifyDaemon          *daemon,
-               const char            *sender,
-               GVariant              *parameters,
-               GDBusMethodInvocation *invocation)
+return_rate_limited (GDBusMethodInvocation *invocation)
+{
+        g_dbus_method_invocation_return_dbus_error (invocation,
+                                                    "org.freedesktop.Notifications.MaxNotificationsExceeded",
+                                                    _("Exceeded maximum number of notifications"));
+}
+
+#ifdef HAVE_IMAGE_FD
+typedef struct
+{
+        gpointer data;
+        gsize    size;
+} ImageMapping;
+
+static void
+unmap_image (ImageMapping *mapping)
+{
+        munmap (mapping->data, mapping->size);
+        g_free (mapping);
+}
+
+/* Maps the sealed memfd of an image-fd hint, (iiibiih), and returns
+ * an equivalent image-data value, (iiibiiay), whose pixel array
+ * points straight into the mapping. */
+static GVariant *
+map_image_fd_hint (GVariant    *value,
+                   GUnixFDList *fd_list)
+{
+        int           width;
+        int           height;
+        int           rowstride;
+        gboolean      has_alpha;
+        int           bits_per_sample;
+        int           n_channels;
+        gint32        handle;
+        guint64       size;
+        int           fd;
+        int           seals;
+        struct stat   st;
+        gpointer      data;
+        ImageMapping *mapping;
+        GVariant     *pixels;
+        GError       *error;
+
+        g_variant_get (value,
+                       "(iiibiih)",
+                       &width,
+                       &height,
+                       &rowstride,
+                       &has_alpha,
+                       &bits_per_sample,
+                       &n_channels,
+                       &handle);
+
+        if (fd_list == NULL
+            || handle < 0
+            || handle >= g_unix_fd_list_get_length (fd_list)) {
+                g_warning ("Ignoring image-fd hint with invalid handle %d", handle);
+                return NULL;
+        }
+
+        /* the pixels the geometry needs, the last row may be short */
+        if (width <= 0
+            || height <= 0
+            || bits_per_sample <= 0
+            || n_channels <= 0
+            || rowstride <= 0) {
+                g_warning ("Ignoring image-fd hint with invalid geometry");
+                return NULL;
+        }
+
+        size = (guint64) (height - 1) * rowstride
+                + ((guint64) width * n_channels * bits_per_sample + 7) / 8;
+        if (size > MAX_IMAGE_FD_SIZE) {
+                g_warning ("Ignoring image-fd hint of %" G_GUINT64_FORMAT " bytes", size);
+                return NULL;
+        }
+
+        error = NULL;
+        fd = g_unix_fd_list_get (fd_list, handle, &error);
+        if (fd < 0) {
+                g_warning ("Invalid image-fd hint: %s", error->message);
+                g_error_free (error);
+                return NULL;
+        }
+
+        seals = fcntl (fd, F_GET_SEALS);
+        if (seals < 0
+            || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE)) {
+                g_warning ("Ignoring image-fd hint that is not sealed against writing and shrinking");
+                close (fd);
+                return NULL;
+        }
+
+        /* sealed against shrinking, so the size can't change below us */
+        if (fstat (fd, &st) < 0 || (guint64) st.st_size < size) {
+                g_warning ("Ignoring image-fd hint smaller than its geometry");
+                close (fd);
+                return NULL;
+        }
+
+        /* only what the image needs, however large the file is */
+        data = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        close (fd);
+
+        if (data == MAP_FAILED) {
+                g_warning ("Unable to map image-fd hint: %s", g_strerror (errno));
+                return NULL;
+        }
+
+        mapping = g_new (ImageMapping, 1);
+        mapping->data = data;
+        mapping->size = size;
+
+        pixels = g_variant_new_from_data (G_VARIANT_TYPE ("ay"),
+                                          mapping->data,
+                                          mapping->size,
+                                          TRUE,
+                                          (GDestroyNotify) unmap_image,
+                                          mapping);
+
+        return g_variant_new ("(iiibii@ay)",
+                              width,
+                              height,
+                              rowstride,
+                              has_alpha,
+                              bits_per_sample,
+                              n_channels,
+                              pixels);
+}
+#endif
+
+/* Returns a new hints dictionary where an image-fd hint has been
+ * replaced by the image-data hint it describes. */
+static GVariant *
+resolve_image_fd_hint (GVariant    *hints,
+                       GUnixFDList *fd_list)
+{
+        GVariantBuilder builder;
+        GVariantIter    iter;
+        const char     *key;
+        GVariant       *value;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+
+        g_variant_iter_init (&iter, hints);
+        while (g_variant_iter_next (&iter, "{&sv}", &key, &value)) {
+                if (strcmp (key, "image-fd") != 0) {
+                        g_variant_builder_add (&builder, "{sv}", key, value);
+                } else {
+#ifdef HAVE_IMAGE_FD
+                        GVariant *image;
+
+                        image = NULL;
+                        if (g_variant_is_of_type (value, G_VARIANT_TYPE ("(iiibiih)"))) {
+                                image = map_image_fd_hint (value, fd_list);
+                        }
+
+                        if (image != NULL) {
+                                g_variant_builder_add (&builder, "{sv}", "image-data", image);
+                        }
+#endif
+                }
+
+                g_variant_unref (value);
+        }
+
+        return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+/* Returns the tag of a synchronous notification, which replaces the
+ * previous one of the same sender even without an id. */
+static const char *
+get_synchronous_tag (GVariant *hints)
+{
+        const char *tag;
+
+        if (g_variant_lookup (hints, "x-canonical-private-synchronous", "&s", &tag)
+            || g_variant_lookup (hints, "synchronous", "&s", &tag)) {
+                return tag;
+        }
+
+        return NULL;
+}
+
+/* Finds a notification created earlier in the same NotifyBatch call,
+ * which is not in the queue yet, by id or by synchronous tag. */
+static NdNotification *
+lookup_pending (GList      *pending,
+                guint       id,
+                const char *tag)
+{
+        GList *l;
+
+        for (l = pending; l != NULL; l = l->next) {
+                NdNotification *n = ND_NOTIFICATION (l->data);
+
+                if (id > 0 ? nd_notification_get_id (n) == id
+                           : g_strcmp0 (nd_notification_get_synchronous (n), tag) == 0) {
+                        return n;
+                }
+        }
+
+        return NULL;
+}
+
+/* Creates or updates a notification from a (susssasa{sv}i) tuple,
+ * which is both the Notify argument list and a NotifyBatch item.
+ * @pending holds the notifications a batch created so far, all from
+ * @sender.  Returns a new reference; *is_new is set when the caller
+ * still has to add the notification to the queue. */
+static NdNotification *
+update_notification_from_variant (NotifyDaemon    *daemon,
+                                  GDBusConnection *connection,
+                                  GUnixFDList     *fd_list,
+                                  const char      *sender,
+                                  GVariant        *parameters,
+                                  GList           *pending,
+                                  gboolean        *is_new)
 {
         NdNotification *notification;
         const char     *app_name;
@@ -179,40 +613,72 @@ handle_notify (NotifyDaemon          *daemon,
         const char     *summary;
         const char     *body;
         const char    **actions;
+        GVariant       *hints;
         GVariantIter   *hints_iter;
         int             timeout;
 
-        if (nd_queue_length (daemon->priv->queue) > MAX_NOTIFICATIONS) {
-                g_dbus_method_invocation_return_dbus_error (invocation,
-                                                            "org.freedesktop.Notifications.MaxNotificationsExceeded",
-                                                            _("Exceeded maximum number of notifications"));
-                return;
-        }
-
         g_variant_get (parameters,
-                       "(&su&s&s&s^a&sa{sv}i)",
+                       "(&su&s&s&s^a&s@a{sv}i)",
                        &app_name,
                        &id,
                        &icon_name,
                        &summary,
                        &body,
                        &actions,
-                       &hints_iter,
+                       &hints,
                        &timeout);
 
+        /* file descriptors only travel with the message */
+        if (fd_list != NULL) {
+                GVariant *resolved;
+
+                resolved = resolve_image_fd_hint (hints, fd_list);
+                g_variant_unref (hints);
+                hints = resolved;
+        }
+        hints_iter = g_variant_iter_new (hints);
+
+        notification = NULL;
         if (id > 0) {
                 notification = nd_queue_lookup (daemon->priv->queue, id);
                 if (notification == NULL) {
-                        id = 0;
-                } else {
-                        g_object_ref (notification);
+                        notification = lookup_pending (pending, id, NULL);
                 }
+        } else {
+                const char *tag;
+
+                tag = get_synchronous_tag (hints);
+                if (tag != NULL) {
+                        notification = nd_queue_lookup_synchronous (daemon->priv->queue, sender, tag);
+                        if (notification != NULL) {
+                                /* a kept notification whose bubble is
+                                   gone would otherwise be updated
+                                   without being seen */
+                                nd_queue_show_again (daemon->priv->queue, notification);
+                        } else {
+                                notification = lookup_pending (pending, 0, tag);
+                        }
+                }
+        }
+        if (notification != NULL) {
+                g_object_ref (notification);
         }
 
-        if (id == 0) {
+        *is_new = (notification == NULL);
+        if (*is_new) {
                 notification = nd_notification_new (sender);
                 g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), daemon);
                 g_signal_connect (notification, "action-invoked", G_CALLBACK (on_notification_action_invoked), daemon);
+                g_object_set_data_full (G_OBJECT (notification),
+                                        "_notify_connection",
+                                        g_object_ref (connection),
+                                        g_object_unref);
+                watch_sender (daemon, connection, sender);
+        } else if (nd_notification_get_is_closed (notification)) {
+                /* a closed notification that is still around, like a
+                   resident one, gave up its count on the sender's watch
+                   and is reopened by the update below */
+                watch_sender (daemon, connection, sender);
         }
 
         nd_notification_update (notification,
@@ -224,7 +690,43 @@ handle_notify (NotifyDaemon          *daemon,
                                 hints_iter,
                                 timeout);
 
-        if (id == 0) {
+        g_free (actions);
+        g_variant_iter_free (hints_iter);
+        g_variant_unref (hints);
+
+        return notification;
+}
+
+static GUnixFDList *
+get_fd_list (GDBusMethodInvocation *invocation)
+{
+        return g_dbus_message_get_unix_fd_list (g_dbus_method_invocation_get_message (invocation));
+}
+
+static void
+handle_notify (NotifyDaemon          *daemon,
+               const char            *sender,
+               GVariant              *parameters,
+               GDBusMethodInvocation *invocation)
+{
+        NdNotification *notification;
+        gboolean        is_new;
+
+        /* the sender's rate limit was already charged by admission_filter() */
+        if (nd_queue_length (daemon->priv->queue) > MAX_NOTIFICATIONS) {
+                return_rate_limited (invocation);
+                return;
+        }
+
+        notification = update_notification_from_variant (daemon,
+                                                         g_dbus_method_invocation_get_connection (invocation),
+                                                         get_fd_list (invocation),
+                                                         sender,
+                                                         parameters,
+                                                         NULL,
+                                                         &is_new);
+
+        if (is_new) {
                 nd_queue_add (daemon->priv->queue, notification);
         }
 
@@ -234,6 +736,82 @@ handle_notify (NotifyDaemon          *daemon,
         g_object_unref (notification);
 }
 
+static void
+handle_notify_batch (NotifyDaemon          *daemon,
+                     const char            *sender,
+                     GVariant              *parameters,
+                     GDBusMethodInvocation *invocation)
+{
+        GVariant        *items;
+        GVariantIter     iter;
+        GVariant        *item;
+        GVariantBuilder *builder;
+        GList           *added;
+        GUnixFDList     *fd_list;
+        guint            length;
+
+        length = nd_queue_length (daemon->priv->queue);
+        if (length > MAX_NOTIFICATIONS) {
+                return_rate_limited (invocation);
+                return;
+        }
+
+        items = g_variant_get_child_value (parameters, 0);
+        fd_list = get_fd_list (invocation);
+
+        builder = g_variant_builder_new (G_VARIANT_TYPE ("au"));
+        added = NULL;
+
+        g_variant_iter_init (&iter, items);
+        while ((item = g_variant_iter_next_value (&iter))) {
+                NdNotification *notification;
+                gboolean        is_new;
+                guint           id;
+
+                /* Items that would overflow the queue get a 0 id, the
+                   rest of the batch is still processed so replacements
+                   of existing notifications keep working. */
+                id = 0;
+                g_variant_get_child (item, 1, "u", &id);
+                if (length > MAX_NOTIFICATIONS
+                    && (id == 0
+                        || (nd_queue_lookup (daemon->priv->queue, id) == NULL
+                            && lookup_pending (added, id, NULL) == NULL))) {
+                        g_variant_builder_add (builder, "u", 0);
+                        g_variant_unref (item);
+                        continue;
+                }
+
+                notification = update_notification_from_variant (daemon,
+                                                                 g_dbus_method_invocation_get_connection (invocation),
+                                                                 fd_list,
+                                                                 sender,
+                                                                 item,
+                                                                 added,
+                                                                 &is_new);
+                if (is_new) {
+                        added = g_list_prepend (added, g_object_ref (notification));
+                        length++;
+                }
+
+                g_variant_builder_add (builder, "u", nd_notification_get_id (notification));
+
+                g_object_unref (notification);
+                g_variant_unref (item);
+        }
+
+        /* a single CHANGED emission and queue update for the whole batch */
+        added = g_list_reverse (added);
+        nd_queue_add_list (daemon->priv->queue, added);
+        g_list_foreach (added, (GFunc) g_object_unref, NULL);
+        g_list_free (added);
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(au)", builder));
+        g_variant_builder_unref (builder);
+        g_variant_unref (items);
+}
+
 static void
 handle_close_notification (NotifyDaemon          *daemon,
                            const char            *sender,
@@ -277,6 +855,9 @@ handle_get_capabilities (NotifyDaemon          *daemon,
         g_variant_builder_add (builder, "s", "sound");
         g_variant_builder_add (builder, "s", "persistence");
         g_variant_builder_add (builder, "s", "action-icons");
+#ifdef HAVE_IMAGE_FD
+        g_variant_builder_add (builder, "s", "image-fd");
+#endif
 
         g_dbus_method_invocation_return_value (invocation,
                                                g_variant_new ("(as)", builder));
@@ -297,6 +878,47 @@ handle_get_server_information (NotifyDaemon          *daemon,
                                                               NOTIFICATION_SPEC_VERSION));
 }
 
+static void
+handle_get_peer_address (NotifyDaemon          *daemon,
+                         const char            *sender,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation)
+{
+        const char *address;
+
+        /* empty when the daemon runs without --peer-socket */
+        address = "";
+        if (daemon->priv->server != NULL) {
+                address = g_dbus_server_get_client_address (daemon->priv->server);
+        }
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(s)", address));
+}
+
+static void
+handle_get_debug_info (NotifyDaemon          *daemon,
+                       const char            *sender,
+                       GVariant              *parameters,
+                       GDBusMethodInvocation *invocation)
+{
+        GVariantBuilder *builder;
+
+        builder = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (builder, "{sv}", "notifications",
+                               g_variant_new_uint32 (nd_queue_length (daemon->priv->queue)));
+        g_variant_builder_add (builder, "{sv}", "rate-limit",
+                               nd_rate_limiter_get_state (daemon->priv->rate_limiter));
+        g_variant_builder_add (builder, "{sv}", "image-cache",
+                               nd_image_cache_get_stats ());
+        g_variant_builder_add (builder, "{sv}", "bubbles",
+                               nd_queue_get_stats (daemon->priv->queue));
+
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(a{sv})", builder));
+        g_variant_builder_unref (builder);
+}
+
 static void
 handle_method_call (GDBusConnection       *connection,
                     const char            *sender,
@@ -309,15 +931,99 @@ handle_method_call (GDBusConnection       *connection,
 {
         NotifyDaemon *daemon = user_data;
 
+        sender = get_client_name (connection, sender);
+
         if (g_strcmp0 (method_name, "Notify") == 0) {
                 handle_notify (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "NotifyBatch") == 0) {
+                handle_notify_batch (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "CloseNotification") == 0) {
                 handle_close_notification (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "GetCapabilities") == 0) {
                 handle_get_capabilities (daemon, sender, parameters, invocation);
         } else if (g_strcmp0 (method_name, "GetServerInformation") == 0) {
                 handle_get_server_information (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetDebugInfo") == 0) {
+                handle_get_debug_info (daemon, sender, parameters, invocation);
+        } else if (g_strcmp0 (method_name, "GetPeerAddress") == 0) {
+                handle_get_peer_address (daemon, sender, parameters, invocation);
+        }
+}
+
+/* Runs in the GDBus worker thread for every message on the
+ * connection.  Notify and NotifyBatch calls that exceed the sender's
+ * rate limit are answered right here, so a flooding client never gets
+ * to wake up the main loop. */
+static GDBusMessage *
+admission_filter (GDBusConnection *connection,
+                  GDBusMessage    *message,
+                  gboolean         incoming,
+                  gpointer         user_data)
+{
+        NotifyDaemon *daemon = user_data;
+        const char   *interface_name;
+        const char   *member;
+        GVariant     *body;
+        guint         cost;
+        GDBusMessage *reply;
+
+        if (! incoming
+            || g_dbus_message_get_message_type (message) != G_DBUS_MESSAGE_TYPE_METHOD_CALL
+            || g_strcmp0 (g_dbus_message_get_path (message), NOTIFICATION_BUS_PATH) != 0) {
+                return message;
+        }
+
+        interface_name = g_dbus_message_get_interface (message);
+        if (interface_name != NULL
+            && strcmp (interface_name, NOTIFICATION_BUS_NAME) != 0) {
+                return message;
         }
+
+        member = g_dbus_message_get_member (message);
+        body = g_dbus_message_get_body (message);
+
+        /* messages with unexpected arguments are left for GDBus to reject */
+        if (g_strcmp0 (member, "Notify") == 0
+            && body != NULL
+            && g_variant_is_of_type (body, G_VARIANT_TYPE ("(susssasa{sv}i)"))) {
+                cost = 1;
+        } else if (g_strcmp0 (member, "NotifyBatch") == 0
+                   && body != NULL
+                   && g_variant_is_of_type (body, G_VARIANT_TYPE ("(a(susssasa{sv}i))"))) {
+                GVariant *items;
+
+                items = g_variant_get_child_value (body, 0);
+                cost = g_variant_n_children (items);
+                g_variant_unref (items);
+        } else {
+                return message;
+        }
+
+        cost += g_variant_get_size (body) / RATE_LIMIT_BYTES_PER_TOKEN;
+
+        if (nd_rate_limiter_consume (daemon->priv->rate_limiter,
+                                     get_client_name (connection, g_dbus_message_get_sender (message)),
+                                     cost)) {
+                return message;
+        }
+
+        /* a caller that expects no reply does not get an error either,
+           that would only add to the flood */
+        if (! (g_dbus_message_get_flags (message) & G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED)) {
+                reply = g_dbus_message_new_method_error (message,
+                                                         "org.freedesktop.Notifications.MaxNotificationsExceeded",
+                                                         "%s",
+                                                         _("Exceeded maximum number of notifications"));
+                g_dbus_connection_send_message (connection,
+                                                reply,
+                                                G_DBUS_SEND_MESSAGE_FLAGS_NONE,
+                                                NULL,
+                                                NULL);
+                g_object_unref (reply);
+        }
+        g_object_unref (message);
+
+        return NULL;
 }
 
 /* for now */
@@ -328,24 +1034,197 @@ static const GDBusInterfaceVTable interface_vtable =
         NULL  /* set property */
 };
 
+static void
+register_objects (NotifyDaemon    *daemon,
+                  GDBusConnection *connection)
+{
+        guint registration_id;
+        int   i;
+
+        g_dbus_connection_add_filter (connection,
+                                      admission_filter,
+                                      daemon,
+                                      NULL);
+
+        for (i = 0; introspection_data->interfaces[i] != NULL; i++) {
+                registration_id = g_dbus_connection_register_object (connection,
+                                                                     "/org/freedesktop/Notifications",
+                                                                     introspection_data->interfaces[i],
+                                                                     &interface_vtable,
+                                                                     daemon,
+                                                                     NULL,  /* user_data_free_func */
+                                                                     NULL); /* GError** */
+                g_assert (registration_id > 0);
+        }
+}
+
 static void
 on_bus_acquired (GDBusConnection *connection,
                  const char      *name,
                  gpointer         user_data)
 {
-        NotifyDaemon *daemon = user_data;
-        guint         registration_id;
+        register_objects (NOTIFY_DAEMON (user_data), connection);
+}
+
+static void
+on_peer_closed (GDBusConnection *connection,
+                gboolean         remote_peer_vanished,
+                GError          *error,
+                NotifyDaemon    *daemon)
+{
+        drop_sender (daemon, CONNECTION_GET_PEER_NAME (connection));
 
-        registration_id = g_dbus_connection_register_object (connection,
-                                                             "/org/freedesktop/Notifications",
-                                                             introspection_data->interfaces[0],
-                                                             &interface_vtable,
-                                                             daemon,
-                                                             NULL,  /* user_data_free_func */
-                                                             NULL); /* GError** */
-        g_assert (registration_id > 0);
+        g_signal_handlers_disconnect_by_func (connection, on_peer_closed, daemon);
+        g_object_unref (connection);
+}
+
+static gboolean
+on_peer_new_connection (GDBusServer     *server,
+                        GDBusConnection *connection,
+                        NotifyDaemon    *daemon)
+{
+        static guint peer_serial = 0;
+
+        g_object_set_data_full (G_OBJECT (connection),
+                                "_notify_peer_name",
+                                g_strdup_printf ("peer-%u", ++peer_serial),
+                                g_free);
+
+        g_debug ("New peer connection %s", (char *) CONNECTION_GET_PEER_NAME (connection));
+
+        register_objects (daemon, connection);
+
+        /* keep the connection around until the peer hangs up */
+        g_object_ref (connection);
+        g_signal_connect (connection, "closed", G_CALLBACK (on_peer_closed), daemon);
+
+        return TRUE;
+}
+
+/* only accept peers running as the same user as the daemon */
+static gboolean
+on_authorize_peer (GDBusAuthObserver *observer,
+                   GIOStream         *stream,
+                   GCredentials      *credentials,
+                   gpointer           user_data)
+{
+        uid_t uid;
+
+        if (credentials == NULL) {
+                return FALSE;
+        }
+
+        uid = g_credentials_get_unix_user (credentials, NULL);
+
+        return uid == getuid ();
+}
+
+/* D-Bus address values only allow a few characters unescaped */
+static char *
+escape_address_value (const char *value)
+{
+        GString *str;
+
+        str = g_string_new (NULL);
+        for (; *value != '\0'; value++) {
+                if (g_ascii_isalnum (*value) || strchr ("-_/.\\*", *value) != NULL) {
+                        g_string_append_c (str, *value);
+                } else {
+                        g_string_append_printf (str, "%%%02x", (guchar) *value);
+                }
+        }
+
+        return g_string_free (str, FALSE);
+}
+
+/* Returns the path of the peer socket, in a directory that only the
+ * user can enter, or NULL if there is no such directory. */
+static char *
+get_peer_socket_path (void)
+{
+        char        *dir;
+        char        *path;
+        struct stat  st;
+
+        dir = g_build_filename (g_get_user_runtime_dir (), "notification-daemon", NULL);
+
+        if (g_mkdir_with_parents (dir, 0700) < 0
+            || lstat (dir, &st) < 0
+            || ! S_ISDIR (st.st_mode)
+            || st.st_uid != getuid ()
+            || (st.st_mode & 0077) != 0) {
+                g_warning ("Not listening for peers, %s is not a private directory", dir);
+                g_free (dir);
+                return NULL;
+        }
+
+        path = g_strdup_printf ("%s/peer-%d", dir, (int) getpid ());
+        g_free (dir);
+
+        return path;
 }
 
+static void
+start_peer_server (NotifyDaemon *daemon)
+{
+        GDBusAuthObserver *observer;
+        GError            *error;
+        char              *path;
+        char              *address;
+        char              *escaped;
+        char              *guid;
+
+        /* a file system socket, unlike an abstract one, is protected by
+           the permissions of its directory */
+        path = get_peer_socket_path ();
+        if (path == NULL) {
+                return;
+        }
+        unlink (path);
+
+        escaped = escape_address_value (path);
+        address = g_strdup_printf ("unix:path=%s", escaped);
+        g_free (escaped);
+
+        guid = g_dbus_generate_guid ();
+        observer = g_dbus_auth_observer_new ();
+        g_signal_connect (observer,
+                          "authorize-authenticated-peer",
+                          G_CALLBACK (on_authorize_peer),
+                          daemon);
+
+        error = NULL;
+        daemon->priv->server = g_dbus_server_new_sync (address,
+                                                       G_DBUS_SERVER_FLAGS_NONE,
+                                                       guid,
+                                                       observer,
+                                                       NULL,
+                                                       &error);
+        if (daemon->priv->server == NULL) {
+                g_warning ("Unable to listen on %s: %s", address, error->message);
+                g_error_free (error);
+                g_free (path);
+        } else {
+                daemon->priv->server_path = path;
+                g_signal_connect (daemon->priv->server,
+                                  "new-connection",
+                                  G_CALLBACK (on_peer_new_connection),
+                                  daemon);
+                g_dbus_server_start (daemon->priv->server);
+                g_debug ("Listening for peers on %s",
+                         g_dbus_server_get_client_address (daemon->priv->server));
+        }
+
+        g_object_unref (observer);
+        g_free (guid);
+        g_free (address);
+}
+
+static double rate_limit = DEFAULT_RATE_LIMIT;
+static int    rate_limit_burst = DEFAULT_RATE_LIMIT_BURST;
+static gboolean peer_socket = FALSE;
+static gboolean no_prewarm = FALSE;
+
 static void
 on_name_acquired (GDBusConnection *connection,
                   const char      *name,
@@ -353,6 +1232,10 @@ on_name_acquired (GDBusConnection *connection,
 {
         NotifyDaemon *daemon = user_data;
         daemon->priv->connection = connection;
+
+        if (! no_prewarm) {
+                nd_queue_prewarm (daemon->priv->queue);
+        }
 }
 
 static void
@@ -363,21 +1246,44 @@ on_name_lost (GDBusConnection *connection,
         exit (1);
 }
 
+static GOptionEntry entries[] = {
+        { "rate-limit", 0, 0, G_OPTION_ARG_DOUBLE, &rate_limit,
+          N_("Notifications per second a single client may send, 0 to disable"), N_("RATE") },
+        { "rate-limit-burst", 0, 0, G_OPTION_ARG_INT, &rate_limit_burst,
+          N_("Notifications a single client may send in a burst"), N_("COUNT") },
+        { "peer-socket", 0, 0, G_OPTION_ARG_NONE, &peer_socket,
+          N_("Also accept peer to peer connections on a private socket"), NULL },
+        { "no-prewarm", 0, 0, G_OPTION_ARG_NONE, &no_prewarm,
+          N_("Do not prepare the first bubble ahead of time, which is needed to time a cold first paint"), NULL },
+        { NULL }
+};
 
 int
 main (int argc, char **argv)
 {
         NotifyDaemon *daemon;
         guint         owner_id;
+        GError       *error;
 
         g_log_set_always_fatal (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL);
 
-        gtk_init (&argc, &argv);
+        error = NULL;
+        if (! gtk_init_with_args (&argc, &argv, NULL, entries, GETTEXT_PACKAGE, &error)) {
+                g_printerr ("%s\n", error->message);
+                g_error_free (error);
+                return 1;
+        }
 
         introspection_data = g_dbus_node_info_new_for_xml (introspection_xml, NULL);
         g_assert (introspection_data != NULL);
 
         daemon = g_object_new (NOTIFY_TYPE_DAEMON, NULL);
+        daemon->priv->rate_limiter = nd_rate_limiter_new (rate_limit,
+                                                          MAX (rate_limit_burst, 1));
+
+        if (peer_socket) {
+                start_peer_server (daemon);
+        }
 
         owner_id = g_bus_own_name (G_BUS_TYPE_SESSION,
                                    "org.freedesktop.Notifications",
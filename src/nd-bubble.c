@@ -25,6 +25,7 @@
 #include <glib.h>
 
 #include "nd-notification.h"
+#include "nd-image-cache.h"
 #include "nd-bubble.h"
 
 #define ND_BUBBLE_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_BUBBLE, NdBubblePrivate))
@@ -39,7 +40,8 @@
 #define BODY_X_OFFSET (IMAGE_SIZE + 8)
 #define BACKGROUND_ALPHA    0.90
 
-#define MAX_ICON_SIZE IMAGE_SIZE
+/* at most one progress update per frame */
+#define VALUE_UPDATE_MSEC   16
 
 struct NdBubblePrivate
 {
@@ -48,10 +50,12 @@ struct NdBubblePrivate
         GtkWidget      *main_hbox;
         GtkWidget      *iconbox;
         GtkWidget      *icon;
+        cairo_surface_t *icon_surface;
         GtkWidget      *content_hbox;
         GtkWidget      *summary_label;
         GtkWidget      *close_button;
         GtkWidget      *body_label;
+        GtkWidget      *progress_bar;
         GtkWidget      *actions_box;
         GtkWidget      *last_sep;
 
@@ -60,21 +64,50 @@ struct NdBubblePrivate
         int             last_width;
         int             last_height;
 
+        /* rendered background, for background_width x background_height */
+        cairo_surface_t *background;
+        int             background_width;
+        int             background_height;
+        GdkColor        background_fill;
+        GdkColor        background_border;
+        gboolean        background_composited;
+
+        /* size the window shape was made for, 0 if not shaped */
+        int             shape_width;
+        int             shape_height;
+
         gboolean        have_icon;
         gboolean        have_body;
         gboolean        have_actions;
+        gboolean        have_value;
+        gboolean        action_icons;
+
+        /* value waiting for the next frame, -1 if none */
+        int             pending_value;
+        guint           value_id;
 
         gboolean        url_clicked_lock;
 
         gboolean        composited;
         glong           remaining;
         guint           timeout_id;
+
+        GCancellable   *image_cancellable;
 };
 
+enum {
+        DISMISSED,
+        LAST_SIGNAL
+};
+
+static guint signals [LAST_SIGNAL] = { 0, };
+
 static void     nd_bubble_class_init  (NdBubbleClass *klass);
 static void     nd_bubble_init        (NdBubble      *bubble);
 static void     nd_bubble_finalize    (GObject       *object);
+static void     nd_bubble_destroy     (GtkWidget     *widget);
 static void     on_notification_changed (NdNotification *notification,
+                                         guint           changes,
                                          NdBubble       *bubble);
 
 G_DEFINE_TYPE (NdBubble, nd_bubble, GTK_TYPE_WINDOW)
@@ -96,7 +129,14 @@ nd_bubble_configure_event (GtkWidget         *widget,
         bubble->priv->width = event->width;
         bubble->priv->height = event->height;
 
-        gtk_widget_queue_draw (widget);
+        /* moves, like when the stack is shifted, don't need a repaint */
+        if (event->width != bubble->priv->last_width
+            || event->height != bubble->priv->last_height) {
+                bubble->priv->last_width = event->width;
+                bubble->priv->last_height = event->height;
+
+                gtk_widget_queue_draw (widget);
+        }
 
         return FALSE;
 }
@@ -181,25 +221,39 @@ override_style (GtkWidget *widget,
 }
 
 static void
-nd_bubble_composited_changed (GtkWidget *widget)
+update_visual (NdBubble *bubble)
 {
-        NdBubble  *bubble = ND_BUBBLE (widget);
         GdkScreen *screen;
         GdkVisual *visual;
 
-        bubble->priv->composited = gdk_screen_is_composited (gtk_widget_get_screen (widget));
-
         screen = gtk_window_get_screen (GTK_WINDOW (bubble));
+        bubble->priv->composited = gdk_screen_is_composited (screen);
+
         visual = gdk_screen_get_rgba_visual (screen);
         if (visual == NULL) {
                 visual = gdk_screen_get_system_visual (screen);
-         }
+        }
 
         gtk_widget_set_visual (GTK_WIDGET (bubble), visual);
+}
+
+static void
+nd_bubble_composited_changed (GtkWidget *widget)
+{
+        update_visual (ND_BUBBLE (widget));
 
         gtk_widget_queue_draw (widget);
 }
 
+static void
+nd_bubble_screen_changed (GtkWidget *widget,
+                          GdkScreen *previous_screen)
+{
+        /* the queue moves new bubbles to the screen of their stack
+           before they are realized */
+        update_visual (ND_BUBBLE (widget));
+}
+
 static void
 draw_round_rect (cairo_t *cr,
                  gdouble  aspect,
@@ -266,23 +320,29 @@ draw_round_rect (cairo_t *cr,
                    270.0f * G_PI / 180.0f);
 }
 
+static gboolean
+background_is_valid (NdBubble *bubble,
+                     GtkStyle *style)
+{
+        return bubble->priv->background != NULL
+                && bubble->priv->background_width == bubble->priv->width
+                && bubble->priv->background_height == bubble->priv->height
+                && bubble->priv->background_composited == bubble->priv->composited
+                && gdk_color_equal (&bubble->priv->background_fill,
+                                    &style->bg [GTK_STATE_NORMAL])
+                && gdk_color_equal (&bubble->priv->background_border,
+                                    &style->text_aa [GTK_STATE_NORMAL]);
+}
+
 static void
-paint_bubble (NdBubble *bubble,
-              cairo_t  *cr)
+update_background (NdBubble *bubble,
+                   cairo_t  *cr,
+                   GtkStyle *style)
 {
         GdkColor         color;
         double           r, g, b;
         cairo_t         *cr2;
         cairo_surface_t *surface;
-        cairo_region_t  *region;
-        GtkStyle        *style;
-        GtkAllocation    allocation;
-
-        gtk_widget_get_allocation (GTK_WIDGET (bubble), &allocation);
-        if (bubble->priv->width == 0 || bubble->priv->height == 0) {
-                bubble->priv->width = MAX (allocation.width, 1);
-                bubble->priv->height = MAX (allocation.height, 1);
-        }
 
         surface = cairo_surface_create_similar (cairo_get_target (cr),
                                                 CAIRO_CONTENT_COLOR_ALPHA,
@@ -300,10 +360,9 @@ paint_bubble (NdBubble *bubble,
                          DEFAULT_X0 + 1,
                          DEFAULT_Y0 + 1,
                          DEFAULT_RADIUS,
-                         allocation.width - 2,
-                         allocation.height - 2);
+                         bubble->priv->width - 2,
+                         bubble->priv->height - 2);
 
-        style = gtk_widget_get_style (GTK_WIDGET (bubble));
         color = style->bg [GTK_STATE_NORMAL];
         r = (float)color.red / 65535.0;
         g = (float)color.green / 65535.0;
@@ -321,33 +380,124 @@ paint_bubble (NdBubble *bubble,
 
         cairo_destroy (cr2);
 
-        cairo_save (cr);
-        cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-        cairo_set_source_surface (cr, surface, 0, 0);
-        cairo_paint (cr);
-        cairo_restore (cr);
+        if (bubble->priv->background != NULL) {
+                cairo_surface_destroy (bubble->priv->background);
+        }
+        bubble->priv->background = surface;
+        bubble->priv->background_width = bubble->priv->width;
+        bubble->priv->background_height = bubble->priv->height;
+        bubble->priv->background_fill = style->bg [GTK_STATE_NORMAL];
+        bubble->priv->background_border = style->text_aa [GTK_STATE_NORMAL];
+        bubble->priv->background_composited = bubble->priv->composited;
+}
+
+/* The shape of the bubble is the rounded rectangle painted by
+ * update_background() including its border line, so its corners have
+ * a radius of DEFAULT_RADIUS + 1.  Each row of the corners becomes a
+ * span covering every pixel the arc touches. */
+static cairo_region_t *
+create_shape_region (int width,
+                     int height)
+{
+        cairo_region_t        *region;
+        cairo_rectangle_int_t  rect;
+        int                    radius;
+        int                    x;
+        int                    y;
+
+        radius = MIN (DEFAULT_RADIUS + 1, MIN (width, height) / 2);
+
+        region = cairo_region_create ();
+
+        rect.x = DEFAULT_X0;
+        rect.y = DEFAULT_Y0 + radius;
+        rect.width = width;
+        rect.height = height - 2 * radius;
+        cairo_region_union_rectangle (region, &rect);
+
+        for (y = 0; y < radius; y++) {
+                int dy = radius - (y + 1);
+
+                /* first pixel whose inner corner is inside the arc */
+                for (x = 0; x < radius; x++) {
+                        int dx = radius - (x + 1);
+
+                        if (dx * dx + dy * dy < radius * radius) {
+                                break;
+                        }
+                }
+
+                rect.x = DEFAULT_X0 + x;
+                rect.width = width - 2 * x;
+                rect.height = 1;
+
+                rect.y = DEFAULT_Y0 + y;
+                cairo_region_union_rectangle (region, &rect);
 
-        if (bubble->priv->width == bubble->priv->last_width
-            && bubble->priv->height == bubble->priv->last_height) {
-                goto done;
+                rect.y = DEFAULT_Y0 + height - 1 - y;
+                cairo_region_union_rectangle (region, &rect);
         }
 
+        return region;
+}
+
+static void
+update_shape (NdBubble *bubble)
+{
+        cairo_region_t *region;
+
         /* Don't shape when composited */
         if (bubble->priv->composited) {
-                gtk_widget_shape_combine_region (GTK_WIDGET (bubble), NULL);
-                goto done;
+                if (bubble->priv->shape_width != 0) {
+                        gtk_widget_shape_combine_region (GTK_WIDGET (bubble), NULL);
+                        bubble->priv->shape_width = 0;
+                        bubble->priv->shape_height = 0;
+                }
+                return;
         }
 
-        bubble->priv->last_width = bubble->priv->width;
-        bubble->priv->last_height = bubble->priv->height;
+        if (bubble->priv->shape_width == bubble->priv->width
+            && bubble->priv->shape_height == bubble->priv->height) {
+                return;
+        }
 
-        region = gdk_cairo_region_create_from_surface (surface);
+        region = create_shape_region (bubble->priv->width, bubble->priv->height);
         gtk_widget_shape_combine_region (GTK_WIDGET (bubble), region);
         cairo_region_destroy (region);
 
- done:
-        cairo_surface_destroy (surface);
+        bubble->priv->shape_width = bubble->priv->width;
+        bubble->priv->shape_height = bubble->priv->height;
+}
+
+/* The background is only rendered again when the size, the colors or
+ * compositing change, and the window only reshaped when the size does;
+ * other redraws, like when the pointer enters the bubble, just paint
+ * the cached surface. */
+static void
+paint_bubble (NdBubble *bubble,
+              cairo_t  *cr)
+{
+        GtkStyle        *style;
+        GtkAllocation    allocation;
+
+        gtk_widget_get_allocation (GTK_WIDGET (bubble), &allocation);
+        if (bubble->priv->width == 0 || bubble->priv->height == 0) {
+                bubble->priv->width = MAX (allocation.width, 1);
+                bubble->priv->height = MAX (allocation.height, 1);
+        }
+
+        style = gtk_widget_get_style (GTK_WIDGET (bubble));
+        if (! background_is_valid (bubble, style)) {
+                update_background (bubble, cr, style);
+        }
+
+        update_shape (bubble);
 
+        cairo_save (cr);
+        cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+        cairo_set_source_surface (cr, bubble->priv->background, 0, 0);
+        cairo_paint (cr);
+        cairo_restore (cr);
 }
 
 static gboolean
@@ -374,8 +524,13 @@ nd_bubble_button_release_event (GtkWidget      *widget,
                 return FALSE;
         }
 
+        /* an action button already dismissed the bubble */
+        if (bubble->priv->notification == NULL) {
+                return FALSE;
+        }
+
         nd_notification_action_invoked (bubble->priv->notification, "default");
-        gtk_widget_destroy (GTK_WIDGET (bubble));
+        nd_bubble_dismiss (bubble);
 
         return FALSE;
 }
@@ -387,7 +542,7 @@ timeout_bubble (NdBubble *bubble)
 
         /* FIXME: if transient also close it */
 
-        gtk_widget_destroy (GTK_WIDGET (bubble));
+        nd_bubble_dismiss (bubble);
 
         return FALSE;
 }
@@ -404,13 +559,34 @@ add_timeout (NdBubble *bubble)
 }
 
 static void
-nd_bubble_realize (GtkWidget *widget)
+remove_timeout (NdBubble *bubble)
+{
+        if (bubble->priv->timeout_id != 0) {
+                g_source_remove (bubble->priv->timeout_id);
+                bubble->priv->timeout_id = 0;
+        }
+}
+
+/* The timeout runs while the bubble is on screen, a bubble waiting
+ * in the pool of the queue stays realized but unmapped. */
+static void
+nd_bubble_map (GtkWidget *widget)
 {
         NdBubble *bubble = ND_BUBBLE (widget);
 
         add_timeout (bubble);
 
-        GTK_WIDGET_CLASS (nd_bubble_parent_class)->realize (widget);
+        GTK_WIDGET_CLASS (nd_bubble_parent_class)->map (widget);
+}
+
+static void
+nd_bubble_unmap (GtkWidget *widget)
+{
+        NdBubble *bubble = ND_BUBBLE (widget);
+
+        remove_timeout (bubble);
+
+        GTK_WIDGET_CLASS (nd_bubble_parent_class)->unmap (widget);
 }
 
 static gboolean
@@ -418,9 +594,8 @@ nd_bubble_enter_notify_event (GtkWidget        *widget,
                               GdkEventCrossing *event)
 {
         NdBubble *bubble = ND_BUBBLE (widget);
-        if (bubble->priv->timeout_id != 0) {
-                g_source_remove (bubble->priv->timeout_id);
-        }
+
+        remove_timeout (bubble);
 
         return FALSE;
 }
@@ -431,7 +606,9 @@ nd_bubble_leave_notify_event (GtkWidget        *widget,
 {
         NdBubble *bubble = ND_BUBBLE (widget);
 
-        add_timeout (bubble);
+        if (gtk_widget_get_mapped (widget)) {
+                add_timeout (bubble);
+        }
         return FALSE;
 }
 
@@ -443,13 +620,27 @@ nd_bubble_class_init (NdBubbleClass *klass)
 
         object_class->finalize = nd_bubble_finalize;
 
+        widget_class->destroy = nd_bubble_destroy;
         widget_class->draw = nd_bubble_draw;
         widget_class->configure_event = nd_bubble_configure_event;
         widget_class->composited_changed = nd_bubble_composited_changed;
+        widget_class->screen_changed = nd_bubble_screen_changed;
         widget_class->button_release_event = nd_bubble_button_release_event;
         widget_class->enter_notify_event = nd_bubble_enter_notify_event;
         widget_class->leave_notify_event = nd_bubble_leave_notify_event;
-        widget_class->realize = nd_bubble_realize;
+        widget_class->map = nd_bubble_map;
+        widget_class->unmap = nd_bubble_unmap;
+
+        signals [DISMISSED] =
+                g_signal_new ("dismissed",
+                              G_TYPE_FROM_CLASS (object_class),
+                              G_SIGNAL_RUN_LAST,
+                              G_STRUCT_OFFSET (NdBubbleClass, dismissed),
+                              NULL,
+                              NULL,
+                              g_cclosure_marshal_VOID__VOID,
+                              G_TYPE_NONE,
+                              0);
 
         g_type_class_add_private (klass, sizeof (NdBubblePrivate));
 }
@@ -492,7 +683,7 @@ on_close_button_clicked (GtkButton *button,
                          NdBubble  *bubble)
 {
         nd_notification_close (bubble->priv->notification, ND_NOTIFICATION_CLOSED_USER);
-        gtk_widget_destroy (GTK_WIDGET (bubble));
+        nd_bubble_dismiss (bubble);
 }
 
 static void
@@ -508,6 +699,19 @@ on_style_set (GtkWidget  *widget,
         g_signal_handlers_unblock_by_func (G_OBJECT (widget), on_style_set, bubble);
 }
 
+static gboolean
+on_icon_draw (GtkWidget *widget,
+              cairo_t   *cr,
+              NdBubble  *bubble)
+{
+        if (bubble->priv->icon_surface != NULL) {
+                cairo_set_source_surface (cr, bubble->priv->icon_surface, 0, 0);
+                cairo_paint (cr);
+        }
+
+        return FALSE;
+}
+
 static void
 nd_bubble_init (NdBubble *bubble)
 {
@@ -518,8 +722,6 @@ nd_bubble_init (NdBubble *bubble)
         GtkWidget   *alignment;
         AtkObject   *atkobj;
         GtkRcStyle  *rcstyle;
-        GdkScreen   *screen;
-        GdkVisual   *visual;
 
         bubble->priv = ND_BUBBLE_GET_PRIVATE (bubble);
 
@@ -531,17 +733,7 @@ nd_bubble_init (NdBubble *bubble)
         gtk_widget_add_events (GTK_WIDGET (bubble), GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK);
         atk_object_set_role (gtk_widget_get_accessible (GTK_WIDGET (bubble)), ATK_ROLE_ALERT);
 
-        screen = gtk_window_get_screen (GTK_WINDOW (bubble));
-        visual = gdk_screen_get_rgba_visual (screen);
-        if (visual == NULL) {
-                visual = gdk_screen_get_system_visual (screen);
-         }
-
-        gtk_widget_set_visual (GTK_WIDGET (bubble), visual);
-
-        if (gdk_screen_is_composited (screen)) {
-                bubble->priv->composited = TRUE;
-        }
+        update_visual (bubble);
 
         main_vbox = gtk_vbox_new (FALSE, 0);
         g_signal_connect (G_OBJECT (main_vbox),
@@ -568,7 +760,11 @@ nd_bubble_init (NdBubble *bubble)
                             FALSE, FALSE, 0);
         gtk_widget_set_size_request (bubble->priv->iconbox, BODY_X_OFFSET, -1);
 
-        bubble->priv->icon = gtk_image_new ();
+        bubble->priv->icon = gtk_drawing_area_new ();
+        g_signal_connect (bubble->priv->icon,
+                          "draw",
+                          G_CALLBACK (on_icon_draw),
+                          bubble);
         gtk_widget_show (bubble->priv->icon);
         gtk_container_add (GTK_CONTAINER (bubble->priv->iconbox), bubble->priv->icon);
 
@@ -652,13 +848,50 @@ nd_bubble_init (NdBubble *bubble)
         atkobj = gtk_widget_get_accessible (bubble->priv->body_label);
         atk_object_set_description (atkobj, "Notification body text.");
 
+        bubble->priv->progress_bar = gtk_progress_bar_new ();
+        gtk_box_pack_start (GTK_BOX (vbox), bubble->priv->progress_bar, FALSE, FALSE, 0);
+        bubble->priv->pending_value = -1;
+
         alignment = gtk_alignment_new (1, 0.5, 0, 0);
         gtk_widget_show (alignment);
         gtk_box_pack_start (GTK_BOX (vbox), alignment, FALSE, TRUE, 0);
 
         bubble->priv->actions_box = gtk_hbox_new (FALSE, 6);
-        gtk_widget_show (bubble->priv->actions_box);
         gtk_container_add (GTK_CONTAINER (alignment), bubble->priv->actions_box);
+
+        alignment = gtk_alignment_new (1, 0.5, 0, 0);
+        gtk_widget_show (alignment);
+        gtk_box_pack_end (GTK_BOX (bubble->priv->actions_box),
+                          alignment,
+                          FALSE, TRUE, 0);
+}
+
+static void
+cancel_image_load (NdBubble *bubble)
+{
+        if (bubble->priv->image_cancellable != NULL) {
+                g_cancellable_cancel (bubble->priv->image_cancellable);
+                g_object_unref (bubble->priv->image_cancellable);
+                bubble->priv->image_cancellable = NULL;
+        }
+}
+
+static void
+clear_value (NdBubble *bubble)
+{
+        if (bubble->priv->value_id != 0) {
+                g_source_remove (bubble->priv->value_id);
+                bubble->priv->value_id = 0;
+        }
+        bubble->priv->pending_value = -1;
+}
+
+static void
+nd_bubble_destroy (GtkWidget *widget)
+{
+        cancel_image_load (ND_BUBBLE (widget));
+
+        GTK_WIDGET_CLASS (nd_bubble_parent_class)->destroy (widget);
 }
 
 static void
@@ -673,13 +906,24 @@ nd_bubble_finalize (GObject *object)
 
         g_return_if_fail (bubble->priv != NULL);
 
-        if (bubble->priv->timeout_id != 0) {
-                g_source_remove (bubble->priv->timeout_id);
+        remove_timeout (bubble);
+
+        clear_value (bubble);
+
+        cancel_image_load (bubble);
+
+        if (bubble->priv->icon_surface != NULL) {
+                cairo_surface_destroy (bubble->priv->icon_surface);
         }
 
-        g_signal_handlers_disconnect_by_func (bubble->priv->notification, G_CALLBACK (on_notification_changed), bubble);
+        if (bubble->priv->background != NULL) {
+                cairo_surface_destroy (bubble->priv->background);
+        }
 
-        g_object_unref (bubble->priv->notification);
+        if (bubble->priv->notification != NULL) {
+                g_signal_handlers_disconnect_by_func (bubble->priv->notification, G_CALLBACK (on_notification_changed), bubble);
+                g_object_unref (bubble->priv->notification);
+        }
 
         G_OBJECT_CLASS (nd_bubble_parent_class)->finalize (object);
 }
@@ -689,6 +933,7 @@ update_content_hbox_visibility (NdBubble *bubble)
 {
         if (bubble->priv->have_icon
             || bubble->priv->have_body
+            || bubble->priv->have_value
             || bubble->priv->have_actions) {
                 gtk_widget_show (bubble->priv->content_hbox);
         } else {
@@ -713,7 +958,6 @@ set_notification_text (NdBubble   *bubble,
         gtk_label_set_markup (GTK_LABEL (bubble->priv->summary_label), str);
 
         g_free (str);
-        gtk_widget_show_all (GTK_WIDGET (bubble));
         gtk_label_set_markup (GTK_LABEL (bubble->priv->body_label), body);
 
         if (body == NULL || *body == '\0') {
@@ -742,73 +986,31 @@ set_notification_text (NdBubble   *bubble,
                                      -1);
 }
 
-static GdkPixbuf *
-scale_pixbuf (GdkPixbuf *pixbuf,
-              int        max_width,
-              int        max_height,
-              gboolean   no_stretch_hint)
-{
-        int        pw;
-        int        ph;
-        float      scale_factor_x = 1.0;
-        float      scale_factor_y = 1.0;
-        float      scale_factor = 1.0;
-
-        pw = gdk_pixbuf_get_width (pixbuf);
-        ph = gdk_pixbuf_get_height (pixbuf);
-
-        /* Determine which dimension requires the smallest scale. */
-        scale_factor_x = (float) max_width / (float) pw;
-        scale_factor_y = (float) max_height / (float) ph;
-
-        if (scale_factor_x > scale_factor_y) {
-                scale_factor = scale_factor_y;
-        } else {
-                scale_factor = scale_factor_x;
-        }
-
-        /* always scale down, allow to disable scaling up */
-        if (scale_factor < 1.0 || !no_stretch_hint) {
-                int scale_x;
-                int scale_y;
-
-                scale_x = (int) (pw * scale_factor);
-                scale_y = (int) (ph * scale_factor);
-                return gdk_pixbuf_scale_simple (pixbuf,
-                                                scale_x,
-                                                scale_y,
-                                                GDK_INTERP_BILINEAR);
-        } else {
-                return g_object_ref (pixbuf);
-        }
-}
-
 static void
-set_notification_icon (NdBubble  *bubble,
-                       GdkPixbuf *pixbuf)
+set_notification_icon (NdBubble        *bubble,
+                       cairo_surface_t *surface)
 {
-        GdkPixbuf  *scaled;
-
-        scaled = NULL;
-        if (pixbuf != NULL) {
-                scaled = scale_pixbuf (pixbuf,
-                                       MAX_ICON_SIZE,
-                                       MAX_ICON_SIZE,
-                                       TRUE);
+        if (bubble->priv->icon_surface != NULL) {
+                cairo_surface_destroy (bubble->priv->icon_surface);
         }
 
-        gtk_image_set_from_pixbuf (GTK_IMAGE (bubble->priv->icon), scaled);
+        /* the notification already scaled and converted the image */
+        bubble->priv->icon_surface = surface != NULL ? cairo_surface_reference (surface) : NULL;
+        gtk_widget_queue_draw (bubble->priv->icon);
 
-        if (scaled != NULL) {
-                int pixbuf_width = gdk_pixbuf_get_width (scaled);
+        if (surface != NULL) {
+                int width = cairo_image_surface_get_width (surface);
 
+                gtk_widget_set_size_request (bubble->priv->icon,
+                                             width,
+                                             cairo_image_surface_get_height (surface));
                 gtk_widget_show (bubble->priv->icon);
                 gtk_widget_set_size_request (bubble->priv->iconbox,
-                                             MAX (BODY_X_OFFSET, pixbuf_width), -1);
-                g_object_unref (scaled);
+                                             MAX (BODY_X_OFFSET, width), -1);
                 bubble->priv->have_icon = TRUE;
         } else {
                 gtk_widget_hide (bubble->priv->icon);
+                gtk_widget_set_size_request (bubble->priv->icon, -1, -1);
                 gtk_widget_set_size_request (bubble->priv->iconbox,
                                              BODY_X_OFFSET,
                                              -1);
@@ -827,31 +1029,38 @@ on_action_clicked (GtkButton      *button,
 
         nd_notification_action_invoked (bubble->priv->notification,
                                         key);
-        gtk_widget_destroy (GTK_WIDGET (bubble));
+        nd_bubble_dismiss (bubble);
 }
 
 static void
-add_notification_action (NdBubble       *bubble,
-                         const char     *text,
-                         const char     *key)
+set_action_label (GtkWidget  *button,
+                  const char *text)
 {
-        GtkWidget *button;
-        GtkWidget *hbox;
-        GdkPixbuf *pixbuf;
+        GtkWidget *label;
         char      *buf;
 
-        if (!gtk_widget_get_visible (bubble->priv->actions_box)) {
-                GtkWidget *alignment;
-
-                gtk_widget_show (bubble->priv->actions_box);
-                update_content_hbox_visibility (bubble);
+        label = g_object_get_data (G_OBJECT (button), "_action_label");
+        if (label == NULL) {
+                atk_object_set_name (gtk_widget_get_accessible (button),
+                                     text);
+                return;
+        }
 
-                alignment = gtk_alignment_new (1, 0.5, 0, 0);
-                gtk_widget_show (alignment);
-                gtk_box_pack_end (GTK_BOX (bubble->priv->actions_box),
-                                  alignment,
-                                  FALSE, TRUE, 0);
+        buf = g_strdup_printf ("<small>%s</small>", text);
+        if (g_strcmp0 (gtk_label_get_label (GTK_LABEL (label)), buf) != 0) {
+                gtk_label_set_markup (GTK_LABEL (label), buf);
         }
+        g_free (buf);
+}
+
+static GtkWidget *
+create_notification_action (NdBubble       *bubble,
+                            const char     *text,
+                            const char     *key)
+{
+        GtkWidget *button;
+        GtkWidget *hbox;
+        GdkPixbuf *pixbuf;
 
         button = gtk_button_new ();
         g_signal_connect (G_OBJECT (button),
@@ -859,7 +1068,6 @@ add_notification_action (NdBubble       *bubble,
                           G_CALLBACK (on_style_set),
                           bubble);
         gtk_widget_show (button);
-        gtk_box_pack_start (GTK_BOX (bubble->priv->actions_box), button, FALSE, FALSE, 0);
         gtk_button_set_relief (GTK_BUTTON (button), GTK_RELIEF_NONE);
         gtk_container_set_border_width (GTK_CONTAINER (button), 0);
 
@@ -869,12 +1077,10 @@ add_notification_action (NdBubble       *bubble,
 
         pixbuf = NULL;
         /* try to load an icon if requested */
-        if (nd_notification_get_action_icons (bubble->priv->notification)) {
-                pixbuf = gtk_icon_theme_load_icon (gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (bubble))),
-                                                   key,
-                                                   20,
-                                                   GTK_ICON_LOOKUP_USE_BUILTIN,
-                                                   NULL);
+        if (bubble->priv->action_icons) {
+                pixbuf = nd_image_cache_load_action_icon (gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (bubble))),
+                                                          key,
+                                                          20);
         }
 
         if (pixbuf != NULL) {
@@ -886,8 +1092,6 @@ add_notification_action (NdBubble       *bubble,
                                   "style-set",
                                   G_CALLBACK (on_style_set),
                                   bubble);
-                atk_object_set_name (gtk_widget_get_accessible (GTK_WIDGET (button)),
-                                     text);
                 gtk_widget_show (image);
                 gtk_box_pack_start (GTK_BOX (hbox), image, FALSE, FALSE, 0);
                 gtk_misc_set_alignment (GTK_MISC (image), 0.5, 0.5);
@@ -902,10 +1106,9 @@ add_notification_action (NdBubble       *bubble,
                 gtk_widget_show (label);
                 gtk_box_pack_start (GTK_BOX (hbox), label, FALSE, FALSE, 0);
                 gtk_misc_set_alignment (GTK_MISC (label), 0, 0.5);
-                buf = g_strdup_printf ("<small>%s</small>", text);
-                gtk_label_set_markup (GTK_LABEL (label), buf);
-                g_free (buf);
+                g_object_set_data (G_OBJECT (button), "_action_label", label);
         }
+        set_action_label (button, text);
 
         g_object_set_data_full (G_OBJECT (button),
                                 "_action_key", g_strdup (key), g_free);
@@ -913,6 +1116,17 @@ add_notification_action (NdBubble       *bubble,
                           "button-release-event",
                           G_CALLBACK (on_action_clicked),
                           bubble);
+
+        return button;
+}
+
+static void
+destroy_action_button (GtkWidget *widget,
+                       gpointer   data)
+{
+        if (GTK_IS_BUTTON (widget)) {
+                gtk_widget_destroy (widget);
+        }
 }
 
 static void
@@ -920,21 +1134,56 @@ clear_actions (NdBubble *bubble)
 {
         gtk_widget_hide (bubble->priv->actions_box);
         gtk_container_foreach (GTK_CONTAINER (bubble->priv->actions_box),
-                               (GtkCallback)gtk_widget_destroy,
+                               destroy_action_button,
                                NULL);
         bubble->priv->have_actions = FALSE;
 }
 
+static GList *
+find_action_button (GList      *buttons,
+                    const char *key)
+{
+        GList *l;
+
+        for (l = buttons; l != NULL; l = l->next) {
+                if (GTK_IS_BUTTON (l->data)
+                    && g_strcmp0 (g_object_get_data (G_OBJECT (l->data), "_action_key"), key) == 0) {
+                        return l;
+                }
+        }
+
+        return NULL;
+}
+
+/* Matches the actions against the buttons already in the bubble by
+ * key.  Existing buttons are kept and relabeled, so replacing a
+ * notification with the same actions neither builds widgets nor loads
+ * icons; only new actions get a button and stale ones are destroyed. */
 static void
-add_actions (NdBubble *bubble)
+update_actions (NdBubble *bubble)
 {
-        char **actions;
-        int    i;
+        char     **actions;
+        GList     *buttons;
+        GList     *link;
+        gboolean   action_icons;
+        int        position;
+        int        i;
+
+        /* buttons show either an icon or a label */
+        action_icons = nd_notification_get_action_icons (bubble->priv->notification);
+        if (action_icons != bubble->priv->action_icons) {
+                clear_actions (bubble);
+                bubble->priv->action_icons = action_icons;
+        }
+
+        buttons = gtk_container_get_children (GTK_CONTAINER (bubble->priv->actions_box));
+        position = 0;
 
         actions = nd_notification_get_actions (bubble->priv->notification);
 
         for (i = 0; actions[i] != NULL; i += 2) {
-                char *l = actions[i + 1];
+                GtkWidget *button;
+                char      *l = actions[i + 1];
 
                 if (l == NULL) {
                         g_warning ("Label not found for action %s. "
@@ -945,61 +1194,260 @@ add_actions (NdBubble *bubble)
                         break;
                 }
 
-                if (strcasecmp (actions[i], "default") != 0) {
-                        add_notification_action (bubble,
-                                                 l,
-                                                 actions[i]);
-                        bubble->priv->have_actions = TRUE;
+                if (strcasecmp (actions[i], "default") == 0) {
+                        continue;
                 }
+
+                link = find_action_button (buttons, actions[i]);
+                if (link != NULL) {
+                        button = link->data;
+                        buttons = g_list_delete_link (buttons, link);
+                        set_action_label (button, l);
+                } else {
+                        button = create_notification_action (bubble, l, actions[i]);
+                        gtk_box_pack_start (GTK_BOX (bubble->priv->actions_box), button, FALSE, FALSE, 0);
+                }
+
+                gtk_box_reorder_child (GTK_BOX (bubble->priv->actions_box), button, position);
+                position++;
+        }
+
+        g_list_foreach (buttons, (GFunc) destroy_action_button, NULL);
+        g_list_free (buttons);
+
+        bubble->priv->have_actions = (position > 0);
+        gtk_widget_set_visible (bubble->priv->actions_box, bubble->priv->have_actions);
+}
+
+static void
+on_image_loaded (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      data)
+{
+        cairo_surface_t *surface;
+        GError          *error;
+
+        error = NULL;
+        surface = nd_notification_load_image_finish (ND_NOTIFICATION (source), result, &error);
+        if (error != NULL) {
+                /* the bubble is gone or the notification was updated */
+                g_error_free (error);
+                return;
+        }
+
+        set_notification_icon (ND_BUBBLE (data), surface);
+        if (surface != NULL) {
+                cairo_surface_destroy (surface);
         }
 }
 
 static void
 update_image (NdBubble *bubble)
 {
-        GdkPixbuf *pixbuf;
+        cairo_surface_t *surface;
 
-        pixbuf = nd_notification_load_image (bubble->priv->notification, IMAGE_SIZE);
-        if (pixbuf != NULL) {
-                set_notification_icon (bubble, pixbuf);
-                g_object_unref (G_OBJECT (pixbuf));
+        cancel_image_load (bubble);
+
+        if (nd_notification_peek_image (bubble->priv->notification, IMAGE_SIZE, &surface)) {
+                set_notification_icon (bubble, surface);
+                if (surface != NULL) {
+                        cairo_surface_destroy (surface);
+                }
+                return;
+        }
+
+        if (! nd_notification_has_image (bubble->priv->notification)) {
+                set_notification_icon (bubble, NULL);
+                return;
+        }
+
+        /* reserve the space of the icon so the bubble does not grow
+           when it arrives */
+        if (! bubble->priv->have_icon) {
+                gtk_widget_set_size_request (bubble->priv->icon, IMAGE_SIZE, IMAGE_SIZE);
+                gtk_widget_show (bubble->priv->icon);
+                bubble->priv->have_icon = TRUE;
+        }
+
+        bubble->priv->image_cancellable = g_cancellable_new ();
+        nd_notification_load_image_async (bubble->priv->notification,
+                                          IMAGE_SIZE,
+                                          bubble->priv->image_cancellable,
+                                          on_image_loaded,
+                                          bubble);
+}
+
+static gboolean
+on_value_timeout (NdBubble *bubble)
+{
+        if (bubble->priv->pending_value >= 0) {
+                gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (bubble->priv->progress_bar),
+                                               bubble->priv->pending_value / 100.0);
+                bubble->priv->pending_value = -1;
+                return TRUE;
         }
+
+        bubble->priv->value_id = 0;
+        return FALSE;
 }
 
+/* Progress popups replace their notification many times a second.
+ * Only showing or hiding the bar changes the layout of the bubble,
+ * new values just repaint it, at most once per frame. */
 static void
-update_bubble (NdBubble *bubble)
+update_value (NdBubble *bubble)
 {
-        set_notification_text (bubble,
-                               nd_notification_get_summary (bubble->priv->notification),
-                               nd_notification_get_body (bubble->priv->notification));
-        clear_actions (bubble);
-        add_actions (bubble);
-        update_image (bubble);
+        int value;
+
+        value = nd_notification_get_value (bubble->priv->notification);
+
+        if ((value >= 0) != bubble->priv->have_value) {
+                bubble->priv->have_value = (value >= 0);
+                gtk_widget_set_visible (bubble->priv->progress_bar, bubble->priv->have_value);
+        }
+
+        if (value < 0) {
+                clear_value (bubble);
+                return;
+        }
+
+        if (bubble->priv->value_id != 0) {
+                bubble->priv->pending_value = value;
+                return;
+        }
+
+        gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (bubble->priv->progress_bar),
+                                       value / 100.0);
+        bubble->priv->value_id = g_timeout_add (VALUE_UPDATE_MSEC,
+                                                (GSourceFunc) on_value_timeout,
+                                                bubble);
+}
+
+static void
+update_bubble (NdBubble *bubble,
+               guint     changes)
+{
+        if (changes & (ND_NOTIFICATION_CHANGED_SUMMARY | ND_NOTIFICATION_CHANGED_BODY)) {
+                set_notification_text (bubble,
+                                       nd_notification_get_summary (bubble->priv->notification),
+                                       nd_notification_get_body (bubble->priv->notification));
+        }
+
+        if (changes & ND_NOTIFICATION_CHANGED_ACTIONS) {
+                update_actions (bubble);
+        }
+
+        if (changes & ND_NOTIFICATION_CHANGED_IMAGE) {
+                update_image (bubble);
+        }
+
+        if (changes & ND_NOTIFICATION_CHANGED_VALUE) {
+                update_value (bubble);
+        }
+
         update_content_hbox_visibility (bubble);
 }
 
 static void
 on_notification_changed (NdNotification *notification,
+                         guint           changes,
                          NdBubble       *bubble)
 {
-        update_bubble (bubble);
+        update_bubble (bubble, changes);
+
+        /* keep a bubble whose content visibly changed on screen,
+           unless the pointer is over it and stopped the timeout
+           already; hints and actions alone don't count */
+        if (bubble->priv->timeout_id != 0
+            && (changes & (ND_NOTIFICATION_CHANGED_SUMMARY
+                           | ND_NOTIFICATION_CHANGED_BODY
+                           | ND_NOTIFICATION_CHANGED_IMAGE
+                           | ND_NOTIFICATION_CHANGED_VALUE)) != 0) {
+                add_timeout (bubble);
+        }
 }
 
 NdBubble *
-nd_bubble_new_for_notification (NdNotification *notification)
+nd_bubble_new (void)
 {
-        NdBubble *bubble;
+        return g_object_new (ND_TYPE_BUBBLE,
+                             "app-paintable", TRUE,
+                             "type", GTK_WINDOW_POPUP,
+                             "title", "Notification",
+                             "resizable", FALSE,
+                             "type-hint", GDK_WINDOW_TYPE_HINT_NOTIFICATION,
+                             NULL);
+}
+
+/* Binds the bubble to another notification, or to none when
+ * @notification is %NULL, so that a hidden bubble can be shown again
+ * without building a new window. */
+void
+nd_bubble_set_notification (NdBubble       *bubble,
+                            NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+        g_return_if_fail (notification == NULL || ND_IS_NOTIFICATION (notification));
+
+        if (bubble->priv->notification == notification) {
+                return;
+        }
+
+        cancel_image_load (bubble);
+
+        if (bubble->priv->notification != NULL) {
+                g_signal_handlers_disconnect_by_func (bubble->priv->notification, G_CALLBACK (on_notification_changed), bubble);
+                g_object_unref (bubble->priv->notification);
+                bubble->priv->notification = NULL;
+        }
+
+        bubble->priv->url_clicked_lock = FALSE;
+
+        if (notification == NULL) {
+                set_notification_icon (bubble, NULL);
+                clear_value (bubble);
+                return;
+        }
 
-        bubble = g_object_new (ND_TYPE_BUBBLE,
-                               "app-paintable", TRUE,
-                               "type", GTK_WINDOW_POPUP,
-                               "title", "Notification",
-                               "resizable", FALSE,
-                               "type-hint", GDK_WINDOW_TYPE_HINT_NOTIFICATION,
-                               NULL);
         bubble->priv->notification = g_object_ref (notification);
         g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), bubble);
-        update_bubble (bubble);
+        update_bubble (bubble, ND_NOTIFICATION_CHANGED_ALL);
+}
+
+/* Takes the bubble off the screen.  The owner decides in its
+ * "dismissed" handler whether the window is destroyed or kept for
+ * another notification. */
+void
+nd_bubble_dismiss (NdBubble *bubble)
+{
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+
+        if (! gtk_widget_get_visible (GTK_WIDGET (bubble))) {
+                return;
+        }
+
+        g_object_ref (bubble);
 
-        return bubble;
+        remove_timeout (bubble);
+        gtk_widget_hide (GTK_WIDGET (bubble));
+        g_signal_emit (bubble, signals [DISMISSED], 0);
+
+        g_object_unref (bubble);
+}
+
+/* Lays out sample text and realizes the hidden bubble, so that fonts,
+ * styles and the window are ready before the first notification. */
+void
+nd_bubble_prewarm (NdBubble *bubble)
+{
+        GtkRequisition req;
+
+        g_return_if_fail (ND_IS_BUBBLE (bubble));
+        g_return_if_fail (bubble->priv->notification == NULL);
+
+        set_notification_text (bubble,
+                               "Notification",
+                               "The quick brown fox <b>jumps</b> over the <i>lazy</i> dog");
+        gtk_widget_size_request (GTK_WIDGET (bubble), &req);
+        gtk_widget_realize (GTK_WIDGET (bubble));
 }
@@ -46,14 +46,20 @@ typedef struct
 {
         GtkWindowClass   parent_class;
 
-        void          (* changed) (NdBubble      *bubble);
+        void          (* changed)   (NdBubble      *bubble);
+        void          (* dismissed) (NdBubble      *bubble);
 } NdBubbleClass;
 
 GType               nd_bubble_get_type                      (void);
 
-NdBubble *          nd_bubble_new_for_notification          (NdNotification *notification);
+NdBubble *          nd_bubble_new                           (void);
 
 NdNotification *    nd_bubble_get_notification              (NdBubble       *bubble);
+void                nd_bubble_set_notification              (NdBubble       *bubble,
+                                                             NdNotification *notification);
+
+void                nd_bubble_dismiss                       (NdBubble       *bubble);
+void                nd_bubble_prewarm                       (NdBubble       *bubble);
 
 G_END_DECLS
 
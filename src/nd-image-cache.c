@@ -0,0 +1,671 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "nd-image-cache.h"
+
+/* Upper bound for the pixel memory held by the cache.  Entries are the
+   cairo surfaces the views paint, shared by every notification showing
+   the same image, so this is all the memory those images take. */
+#define MAX_CACHE_BYTES (4 * 1024 * 1024)
+
+/* Upper bound for the action icons remembered per icon theme */
+#define MAX_ACTION_ICONS 256
+
+typedef struct
+{
+        char          *key;
+        NdImageSource    type;
+        cairo_surface_t *surface;
+        gsize            n_bytes;
+        GList         *link;
+        guint          serial;
+
+        /* for ND_IMAGE_SOURCE_FILE */
+        char          *filename;
+        time_t         mtime;
+        ino_t          inode;
+        dev_t          device;
+
+        /* for ND_IMAGE_SOURCE_DATA, the pixels the image came from */
+        guchar        *data;
+        gsize          data_len;
+} CacheEntry;
+
+typedef struct
+{
+        /* entries by size and path or icon name */
+        GHashTable *entries;
+        /* image-data entries by size, hash and geometry, kept apart
+           so no path a client sends can name one */
+        GHashTable *data_entries;
+        GQueue     *lru;
+        gsize       n_bytes;
+        guint       next_serial;
+        guint       hits;
+        guint       misses;
+        guint       evictions;
+        gboolean    watching_theme;
+} ImageCache;
+
+/* Images are loaded in worker threads, so everything below is
+ * protected by this lock. */
+G_LOCK_DEFINE_STATIC (cache);
+static ImageCache *cache = NULL;
+
+static void
+free_entry (CacheEntry *entry)
+{
+        g_free (entry->key);
+        g_free (entry->filename);
+        g_free (entry->data);
+        cairo_surface_destroy (entry->surface);
+        g_free (entry);
+}
+
+static ImageCache *
+get_cache (void)
+{
+        if (cache == NULL) {
+                cache = g_new0 (ImageCache, 1);
+                cache->entries = g_hash_table_new (g_str_hash, g_str_equal);
+                cache->data_entries = g_hash_table_new (g_str_hash, g_str_equal);
+                cache->lru = g_queue_new ();
+        }
+
+        return cache;
+}
+
+static char *
+make_key (const char *source,
+          int         size)
+{
+        return g_strdup_printf ("%d:%s", size, source);
+}
+
+static GHashTable *
+get_table (NdImageSource type)
+{
+        return type == ND_IMAGE_SOURCE_DATA ? cache->data_entries : cache->entries;
+}
+
+static void
+remove_entry (CacheEntry *entry)
+{
+        g_hash_table_remove (get_table (entry->type), entry->key);
+        g_queue_delete_link (cache->lru, entry->link);
+        cache->n_bytes -= entry->n_bytes;
+        free_entry (entry);
+}
+
+static void
+on_icon_theme_changed (GtkIconTheme *theme,
+                       gpointer      data)
+{
+        GList *l;
+        GList *next;
+
+        g_debug ("Icon theme changed, dropping cached theme icons");
+
+        G_LOCK (cache);
+        for (l = cache->lru->head; l != NULL; l = next) {
+                CacheEntry *entry = l->data;
+
+                next = l->next;
+                if (entry->type == ND_IMAGE_SOURCE_THEME) {
+                        remove_entry (entry);
+                }
+        }
+        G_UNLOCK (cache);
+}
+
+static gboolean
+file_is_unchanged (const char *filename,
+                   time_t      mtime,
+                   ino_t       inode,
+                   dev_t       device)
+{
+        struct stat st;
+
+        if (g_stat (filename, &st) != 0) {
+                return FALSE;
+        }
+
+        return st.st_mtime == mtime
+                && st.st_ino == inode
+                && st.st_dev == device;
+}
+
+/* Returns the entry for key, as long as it is still the one with the
+ * given serial.  Called with the lock held. */
+static CacheEntry *
+lookup_entry (const char *key,
+              guint       serial)
+{
+        CacheEntry *entry;
+
+        entry = g_hash_table_lookup (cache->entries, key);
+        if (entry == NULL || entry->serial != serial) {
+                return NULL;
+        }
+
+        return entry;
+}
+
+/* Returns a new reference to the cached image for source at size, or
+ * NULL.  File entries are checked against the file on disk first,
+ * without holding the lock, so a hung file system only blocks the
+ * caller.  May be called from any thread. */
+cairo_surface_t *
+nd_image_cache_lookup (const char *source,
+                       int         size)
+{
+        CacheEntry      *entry;
+        cairo_surface_t *surface;
+        char            *key;
+
+        key = make_key (source, size);
+
+        G_LOCK (cache);
+        get_cache ();
+
+        entry = g_hash_table_lookup (cache->entries, key);
+
+        if (entry != NULL && entry->type == ND_IMAGE_SOURCE_FILE) {
+                char     *filename;
+                time_t    mtime;
+                ino_t     inode;
+                dev_t     device;
+                guint     serial;
+                gboolean  valid;
+
+                filename = g_strdup (entry->filename);
+                mtime = entry->mtime;
+                inode = entry->inode;
+                device = entry->device;
+                serial = entry->serial;
+                G_UNLOCK (cache);
+
+                valid = file_is_unchanged (filename, mtime, inode, device);
+                g_free (filename);
+
+                /* the entry may have gone while the lock was released */
+                G_LOCK (cache);
+                entry = lookup_entry (key, serial);
+                if (entry != NULL && ! valid) {
+                        remove_entry (entry);
+                        entry = NULL;
+                }
+        }
+        g_free (key);
+
+        if (entry == NULL) {
+                cache->misses++;
+                G_UNLOCK (cache);
+                return NULL;
+        }
+
+        cache->hits++;
+
+        /* move to the front of the LRU list */
+        g_queue_unlink (cache->lru, entry->link);
+        g_queue_push_head_link (cache->lru, entry->link);
+
+        surface = cairo_surface_reference (entry->surface);
+        G_UNLOCK (cache);
+
+        return surface;
+}
+
+/* Returns a new reference to the cached theme icon name at size, or
+ * NULL.  Unlike nd_image_cache_lookup() this never touches the file
+ * system, so it is cheap enough for the main thread.  A miss is not
+ * counted, as the caller goes on with a full lookup. */
+cairo_surface_t *
+nd_image_cache_lookup_icon (const char *name,
+                            int         size)
+{
+        CacheEntry      *entry;
+        cairo_surface_t *surface;
+        char            *key;
+
+        G_LOCK (cache);
+        get_cache ();
+
+        key = make_key (name, size);
+        entry = g_hash_table_lookup (cache->entries, key);
+        g_free (key);
+
+        if (entry == NULL || entry->type != ND_IMAGE_SOURCE_THEME) {
+                G_UNLOCK (cache);
+                return NULL;
+        }
+
+        cache->hits++;
+
+        g_queue_unlink (cache->lru, entry->link);
+        g_queue_push_head_link (cache->lru, entry->link);
+
+        surface = cairo_surface_reference (entry->surface);
+        G_UNLOCK (cache);
+
+        return surface;
+}
+
+static CacheEntry *
+new_entry (NdImageSource    type,
+           cairo_surface_t *surface)
+{
+        CacheEntry *entry;
+        gsize       n_bytes;
+
+        n_bytes = (gsize) cairo_image_surface_get_stride (surface)
+                * cairo_image_surface_get_height (surface);
+        if (n_bytes > MAX_CACHE_BYTES) {
+                return NULL;
+        }
+
+        entry = g_new0 (CacheEntry, 1);
+        entry->type = type;
+        entry->n_bytes = n_bytes;
+        entry->surface = cairo_surface_reference (surface);
+
+        return entry;
+}
+
+/* Takes the lock and adds entry, evicting older ones to make room */
+static void
+insert_entry (CacheEntry *entry)
+{
+        GHashTable *table;
+        CacheEntry *old;
+
+        G_LOCK (cache);
+        get_cache ();
+
+        if (entry->type == ND_IMAGE_SOURCE_THEME && ! cache->watching_theme) {
+                g_signal_connect (gtk_icon_theme_get_default (),
+                                  "changed",
+                                  G_CALLBACK (on_icon_theme_changed),
+                                  NULL);
+                cache->watching_theme = TRUE;
+        }
+
+        table = get_table (entry->type);
+
+        old = g_hash_table_lookup (table, entry->key);
+        if (old != NULL) {
+                remove_entry (old);
+        }
+
+        /* evict least recently used entries until the new one fits */
+        while (cache->n_bytes + entry->n_bytes > MAX_CACHE_BYTES
+               && cache->lru->tail != NULL) {
+                remove_entry (cache->lru->tail->data);
+                cache->evictions++;
+        }
+
+        entry->serial = cache->next_serial++;
+        g_queue_push_head (cache->lru, entry);
+        entry->link = cache->lru->head;
+        g_hash_table_insert (table, entry->key, entry);
+        cache->n_bytes += entry->n_bytes;
+        G_UNLOCK (cache);
+}
+
+/* Adds an image loaded from a file or the icon theme.  May be called
+ * from any thread, except for ND_IMAGE_SOURCE_THEME entries which have
+ * to be added from the main thread.  Image data goes through
+ * nd_image_cache_add_data() instead. */
+void
+nd_image_cache_add (const char      *source,
+                    int              size,
+                    NdImageSource    type,
+                    const char      *filename,
+                    cairo_surface_t *surface)
+{
+        CacheEntry *entry;
+
+        g_return_if_fail (source != NULL);
+        g_return_if_fail (type != ND_IMAGE_SOURCE_DATA);
+        g_return_if_fail (surface != NULL);
+        g_return_if_fail (cairo_surface_status (surface) == CAIRO_STATUS_SUCCESS);
+
+        entry = new_entry (type, surface);
+        if (entry == NULL) {
+                return;
+        }
+
+        if (type == ND_IMAGE_SOURCE_FILE) {
+                struct stat st;
+
+                if (filename == NULL || g_stat (filename, &st) != 0) {
+                        free_entry (entry);
+                        return;
+                }
+
+                entry->filename = g_strdup (filename);
+                entry->mtime = st.st_mtime;
+                entry->inode = st.st_ino;
+                entry->device = st.st_dev;
+        }
+
+        entry->key = make_key (source, size);
+
+        insert_entry (entry);
+}
+
+static char *
+make_data_key (guint64     hash,
+               const char *geometry,
+               int         size)
+{
+        return g_strdup_printf ("%d:%016" G_GINT64_MODIFIER "x:%s", size, hash, geometry);
+}
+
+/* Returns a new reference to the image made from data at size, or
+ * NULL.  @hash is nd_image_cache_hash() of data, and @geometry has to
+ * describe everything else the image depends on.  As the hash is easy
+ * to collide on purpose, a hit only counts when the pixels are the
+ * same too.  May be called from any thread. */
+cairo_surface_t *
+nd_image_cache_lookup_data (gconstpointer  data,
+                            gsize          len,
+                            guint64        hash,
+                            const char    *geometry,
+                            int            size)
+{
+        CacheEntry      *entry;
+        cairo_surface_t *surface;
+        char            *key;
+
+        key = make_data_key (hash, geometry, size);
+
+        G_LOCK (cache);
+        get_cache ();
+
+        entry = g_hash_table_lookup (cache->data_entries, key);
+        g_free (key);
+
+        if (entry == NULL
+            || entry->data_len != len
+            || memcmp (entry->data, data, len) != 0) {
+                cache->misses++;
+                G_UNLOCK (cache);
+                return NULL;
+        }
+
+        cache->hits++;
+
+        g_queue_unlink (cache->lru, entry->link);
+        g_queue_push_head_link (cache->lru, entry->link);
+
+        surface = cairo_surface_reference (entry->surface);
+        G_UNLOCK (cache);
+
+        return surface;
+}
+
+/* Adds the image made from data at size, keeping a copy of data to
+ * tell it apart from other data with the same hash.  The copy counts
+ * against the memory limit of the cache.  May be called from any
+ * thread. */
+void
+nd_image_cache_add_data (gconstpointer    data,
+                         gsize            len,
+                         guint64          hash,
+                         const char      *geometry,
+                         int              size,
+                         cairo_surface_t *surface)
+{
+        CacheEntry *entry;
+
+        g_return_if_fail (data != NULL);
+        g_return_if_fail (geometry != NULL);
+        g_return_if_fail (surface != NULL);
+        g_return_if_fail (cairo_surface_status (surface) == CAIRO_STATUS_SUCCESS);
+
+        entry = new_entry (ND_IMAGE_SOURCE_DATA, surface);
+        if (entry == NULL) {
+                return;
+        }
+
+        entry->n_bytes += len;
+        if (entry->n_bytes > MAX_CACHE_BYTES) {
+                free_entry (entry);
+                return;
+        }
+
+        entry->data = g_memdup (data, len);
+        entry->data_len = len;
+        entry->key = make_data_key (hash, geometry, size);
+
+        insert_entry (entry);
+}
+
+static void
+unref_action_icon (GdkPixbuf *pixbuf)
+{
+        if (pixbuf != NULL) {
+                g_object_unref (pixbuf);
+        }
+}
+
+static void
+on_action_icon_theme_changed (GtkIconTheme *theme,
+                              GHashTable   *icons)
+{
+        g_hash_table_remove_all (icons);
+}
+
+/* Action buttons look up the same few icon names over and over, so
+ * each icon theme remembers the icons it found, and the names it did
+ * not find, until it changes.  Only used on the main thread. */
+GdkPixbuf *
+nd_image_cache_load_action_icon (GtkIconTheme *icon_theme,
+                                 const char   *name,
+                                 int           size)
+{
+        GHashTable *icons;
+        GdkPixbuf  *pixbuf;
+        gpointer    value;
+        char       *key;
+
+        g_return_val_if_fail (GTK_IS_ICON_THEME (icon_theme), NULL);
+        g_return_val_if_fail (name != NULL, NULL);
+
+        icons = g_object_get_data (G_OBJECT (icon_theme), "nd-action-icons");
+        if (icons == NULL) {
+                icons = g_hash_table_new_full (g_str_hash,
+                                               g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify) unref_action_icon);
+                g_object_set_data_full (G_OBJECT (icon_theme),
+                                        "nd-action-icons",
+                                        icons,
+                                        (GDestroyNotify) g_hash_table_destroy);
+                g_signal_connect (icon_theme,
+                                  "changed",
+                                  G_CALLBACK (on_action_icon_theme_changed),
+                                  icons);
+        }
+
+        key = make_key (name, size);
+        if (g_hash_table_lookup_extended (icons, key, NULL, &value)) {
+                g_free (key);
+                return value != NULL ? g_object_ref (value) : NULL;
+        }
+
+        pixbuf = gtk_icon_theme_load_icon (icon_theme,
+                                           name,
+                                           size,
+                                           GTK_ICON_LOOKUP_USE_BUILTIN,
+                                           NULL);
+
+        /* action names come from the clients */
+        if (g_hash_table_size (icons) >= MAX_ACTION_ICONS) {
+                g_hash_table_remove_all (icons);
+        }
+        g_hash_table_insert (icons,
+                             key,
+                             pixbuf != NULL ? g_object_ref (pixbuf) : NULL);
+
+        return pixbuf;
+}
+
+/* xxHash64, see http://cyan4973.github.io/xxHash/ */
+
+#define PRIME64_1 G_GUINT64_CONSTANT (0x9E3779B185EBCA87)
+#define PRIME64_2 G_GUINT64_CONSTANT (0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 G_GUINT64_CONSTANT (0x165667B19E3779F9)
+#define PRIME64_4 G_GUINT64_CONSTANT (0x85EBCA77C2B2AE63)
+#define PRIME64_5 G_GUINT64_CONSTANT (0x27D4EB2F165667C5)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline guint64
+read64 (const guchar *p)
+{
+        guint64 v;
+
+        memcpy (&v, p, sizeof (v));
+        return GUINT64_FROM_LE (v);
+}
+
+static inline guint32
+read32 (const guchar *p)
+{
+        guint32 v;
+
+        memcpy (&v, p, sizeof (v));
+        return GUINT32_FROM_LE (v);
+}
+
+static inline guint64
+hash_round (guint64 acc,
+            guint64 input)
+{
+        acc += input * PRIME64_2;
+        acc = ROTL64 (acc, 31);
+        return acc * PRIME64_1;
+}
+
+static inline guint64
+hash_merge_round (guint64 acc,
+                  guint64 val)
+{
+        acc ^= hash_round (0, val);
+        return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* Fast non-cryptographic hash used to recognize image data that was
+ * already seen, e.g. the same avatar sent with every chat message. */
+guint64
+nd_image_cache_hash (gconstpointer data,
+                     gsize         len,
+                     guint64       seed)
+{
+        const guchar *p = data;
+        const guchar *end = p + len;
+        guint64       h;
+
+        if (len >= 32) {
+                const guchar *limit = end - 32;
+                guint64       v1 = seed + PRIME64_1 + PRIME64_2;
+                guint64       v2 = seed + PRIME64_2;
+                guint64       v3 = seed;
+                guint64       v4 = seed - PRIME64_1;
+
+                do {
+                        v1 = hash_round (v1, read64 (p));
+                        v2 = hash_round (v2, read64 (p + 8));
+                        v3 = hash_round (v3, read64 (p + 16));
+                        v4 = hash_round (v4, read64 (p + 24));
+                        p += 32;
+                } while (p <= limit);
+
+                h = ROTL64 (v1, 1) + ROTL64 (v2, 7) + ROTL64 (v3, 12) + ROTL64 (v4, 18);
+                h = hash_merge_round (h, v1);
+                h = hash_merge_round (h, v2);
+                h = hash_merge_round (h, v3);
+                h = hash_merge_round (h, v4);
+        } else {
+                h = seed + PRIME64_5;
+        }
+
+        h += (guint64) len;
+
+        while (p + 8 <= end) {
+                h ^= hash_round (0, read64 (p));
+                h = ROTL64 (h, 27) * PRIME64_1 + PRIME64_4;
+                p += 8;
+        }
+
+        if (p + 4 <= end) {
+                h ^= (guint64) read32 (p) * PRIME64_1;
+                h = ROTL64 (h, 23) * PRIME64_2 + PRIME64_3;
+                p += 4;
+        }
+
+        while (p < end) {
+                h ^= (*p) * PRIME64_5;
+                h = ROTL64 (h, 11) * PRIME64_1;
+                p++;
+        }
+
+        h ^= h >> 33;
+        h *= PRIME64_2;
+        h ^= h >> 29;
+        h *= PRIME64_3;
+        h ^= h >> 32;
+
+        return h;
+}
+
+/* Returns a floating a{sv} with the cache counters, for debugging */
+GVariant *
+nd_image_cache_get_stats (void)
+{
+        GVariantBuilder builder;
+
+        G_LOCK (cache);
+        get_cache ();
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", "hits", g_variant_new_uint32 (cache->hits));
+        g_variant_builder_add (&builder, "{sv}", "misses", g_variant_new_uint32 (cache->misses));
+        g_variant_builder_add (&builder, "{sv}", "evictions", g_variant_new_uint32 (cache->evictions));
+        g_variant_builder_add (&builder, "{sv}", "entries", g_variant_new_uint32 (g_hash_table_size (cache->entries)));
+        g_variant_builder_add (&builder, "{sv}", "data-entries", g_variant_new_uint32 (g_hash_table_size (cache->data_entries)));
+        g_variant_builder_add (&builder, "{sv}", "bytes", g_variant_new_uint64 (cache->n_bytes));
+        g_variant_builder_add (&builder, "{sv}", "max-bytes", g_variant_new_uint64 (MAX_CACHE_BYTES));
+        G_UNLOCK (cache);
+
+        return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,71 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_IMAGE_CACHE_H
+#define __ND_IMAGE_CACHE_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+        ND_IMAGE_SOURCE_FILE,
+        ND_IMAGE_SOURCE_THEME,
+        ND_IMAGE_SOURCE_DATA
+} NdImageSource;
+
+cairo_surface_t *   nd_image_cache_lookup                   (const char      *source,
+                                                             int              size);
+cairo_surface_t *   nd_image_cache_lookup_icon              (const char      *name,
+                                                             int              size);
+void                nd_image_cache_add                      (const char      *source,
+                                                             int              size,
+                                                             NdImageSource    type,
+                                                             const char      *filename,
+                                                             cairo_surface_t *surface);
+
+cairo_surface_t *   nd_image_cache_lookup_data              (gconstpointer    data,
+                                                             gsize            len,
+                                                             guint64          hash,
+                                                             const char      *geometry,
+                                                             int              size);
+void                nd_image_cache_add_data                 (gconstpointer    data,
+                                                             gsize            len,
+                                                             guint64          hash,
+                                                             const char      *geometry,
+                                                             int              size,
+                                                             cairo_surface_t *surface);
+
+GdkPixbuf *         nd_image_cache_load_action_icon         (GtkIconTheme  *icon_theme,
+                                                             const char    *name,
+                                                             int            size);
+
+guint64             nd_image_cache_hash                     (gconstpointer  data,
+                                                             gsize          len,
+                                                             guint64        seed);
+
+GVariant *          nd_image_cache_get_stats                (void);
+
+G_END_DECLS
+
+#endif /* __ND_IMAGE_CACHE_H */
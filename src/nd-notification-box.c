@@ -25,6 +25,7 @@
 #include <glib.h>
 
 #include "nd-notification.h"
+#include "nd-image-cache.h"
 #include "nd-notification-box.h"
 
 #define ND_NOTIFICATION_BOX_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), ND_TYPE_NOTIFICATION_BOX, NdNotificationBoxPrivate))
@@ -38,6 +39,7 @@ struct NdNotificationBoxPrivate
         NdNotification *notification;
 
         GtkWidget      *icon;
+        cairo_surface_t *icon_surface;
         GtkWidget      *close_button;
         GtkWidget      *summary_label;
         GtkWidget      *body_label;
@@ -47,11 +49,18 @@ struct NdNotificationBoxPrivate
         GtkWidget      *content_hbox;
         GtkWidget      *actions_box;
         GtkWidget      *last_sep;
+
+        GCancellable   *image_cancellable;
+
+        gboolean        have_icon;
+        gboolean        have_body;
+        gboolean        have_actions;
 };
 
 static void     nd_notification_box_class_init  (NdNotificationBoxClass *klass);
 static void     nd_notification_box_init        (NdNotificationBox      *notification_box);
 static void     nd_notification_box_finalize    (GObject                *object);
+static void     nd_notification_box_destroy     (GtkWidget              *widget);
 
 G_DEFINE_TYPE (NdNotificationBox, nd_notification_box, GTK_TYPE_EVENT_BOX)
 
@@ -81,6 +90,7 @@ nd_notification_box_class_init (NdNotificationBoxClass *klass)
         GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
 
         object_class->finalize = nd_notification_box_finalize;
+        widget_class->destroy = nd_notification_box_destroy;
         widget_class->button_release_event = nd_notification_box_button_release_event;
 
         g_type_class_add_private (klass, sizeof (NdNotificationBoxPrivate));
@@ -127,11 +137,9 @@ create_notification_action (NdNotificationBox *box,
         pixbuf = NULL;
         /* try to load an icon if requested */
         if (nd_notification_get_action_icons (box->priv->notification)) {
-                pixbuf = gtk_icon_theme_load_icon (gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (box))),
-                                                   key,
-                                                   20,
-                                                   GTK_ICON_LOOKUP_USE_BUILTIN,
-                                                   NULL);
+                pixbuf = nd_image_cache_load_action_icon (gtk_icon_theme_get_for_screen (gtk_widget_get_screen (GTK_WIDGET (box))),
+                                                          key,
+                                                          20);
         }
 
         if (pixbuf != NULL) {
@@ -174,34 +182,134 @@ remove_item (GtkWidget *item,
 }
 
 static void
-update_notification_box (NdNotificationBox *notification_box)
+cancel_image_load (NdNotificationBox *notification_box)
 {
-        gboolean       have_icon;
-        gboolean       have_body;
-        gboolean       have_actions;
-        GdkPixbuf     *pixbuf;
-        char         **actions;
-        int            i;
-        char          *str;
-        char          *quoted;
-        GtkRequisition req;
-        int            summary_width;
+        if (notification_box->priv->image_cancellable != NULL) {
+                g_cancellable_cancel (notification_box->priv->image_cancellable);
+                g_object_unref (notification_box->priv->image_cancellable);
+                notification_box->priv->image_cancellable = NULL;
+        }
+}
 
-        /* Add content */
+static void
+set_icon_surface (NdNotificationBox *notification_box,
+                  cairo_surface_t   *surface)
+{
+        if (notification_box->priv->icon_surface != NULL) {
+                cairo_surface_destroy (notification_box->priv->icon_surface);
+        }
 
-        have_icon = FALSE;
-        have_body = FALSE;
-        have_actions = FALSE;
+        notification_box->priv->icon_surface = surface != NULL ? cairo_surface_reference (surface) : NULL;
 
-        /* image */
-        pixbuf = nd_notification_load_image (notification_box->priv->notification, IMAGE_SIZE);
-        if (pixbuf != NULL) {
-                gtk_image_set_from_pixbuf (GTK_IMAGE (notification_box->priv->icon), pixbuf);
+        if (surface != NULL) {
+                gtk_widget_set_size_request (notification_box->priv->icon,
+                                             cairo_image_surface_get_width (surface),
+                                             cairo_image_surface_get_height (surface));
+        } else {
+                gtk_widget_set_size_request (notification_box->priv->icon, -1, -1);
+        }
+        gtk_widget_queue_draw (notification_box->priv->icon);
+}
+
+static gboolean
+on_icon_draw (GtkWidget         *widget,
+              cairo_t           *cr,
+              NdNotificationBox *notification_box)
+{
+        if (notification_box->priv->icon_surface != NULL) {
+                cairo_set_source_surface (cr, notification_box->priv->icon_surface, 0, 0);
+                cairo_paint (cr);
+        }
+
+        return FALSE;
+}
+
+static void
+update_content_hbox_visibility (NdNotificationBox *notification_box)
+{
+        if (notification_box->priv->have_icon
+            || notification_box->priv->have_body
+            || notification_box->priv->have_actions) {
+                gtk_widget_show (notification_box->priv->content_hbox);
+        } else {
+                gtk_widget_hide (notification_box->priv->content_hbox);
+        }
+}
+
+static void
+on_image_loaded (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      data)
+{
+        NdNotificationBox *notification_box;
+        cairo_surface_t   *surface;
+        GError            *error;
+
+        error = NULL;
+        surface = nd_notification_load_image_finish (ND_NOTIFICATION (source), result, &error);
+        if (error != NULL) {
+                /* the box is gone or the notification was updated */
+                g_error_free (error);
+                return;
+        }
+
+        notification_box = ND_NOTIFICATION_BOX (data);
+        set_icon_surface (notification_box, surface);
+
+        /* the slot was kept for an image that turned out missing */
+        notification_box->priv->have_icon = (surface != NULL);
+        update_content_hbox_visibility (notification_box);
+
+        if (surface != NULL) {
+                cairo_surface_destroy (surface);
+        }
+}
+
+static gboolean
+update_image (NdNotificationBox *notification_box)
+{
+        cairo_surface_t *surface;
+
+        cancel_image_load (notification_box);
+
+        if (nd_notification_peek_image (notification_box->priv->notification, IMAGE_SIZE, &surface)) {
+                set_icon_surface (notification_box, surface);
+                if (surface == NULL) {
+                        return FALSE;
+                }
+
+                cairo_surface_destroy (surface);
+                return TRUE;
+        }
 
-                g_object_unref (G_OBJECT (pixbuf));
-                have_icon = TRUE;
+        if (! nd_notification_has_image (notification_box->priv->notification)) {
+                set_icon_surface (notification_box, NULL);
+                return FALSE;
         }
 
+        /* keep the space for the icon while it is being loaded */
+        set_icon_surface (notification_box, NULL);
+        gtk_widget_set_size_request (notification_box->priv->icon, IMAGE_SIZE, IMAGE_SIZE);
+
+        notification_box->priv->image_cancellable = g_cancellable_new ();
+        nd_notification_load_image_async (notification_box->priv->notification,
+                                          IMAGE_SIZE,
+                                          notification_box->priv->image_cancellable,
+                                          on_image_loaded,
+                                          notification_box);
+
+        return TRUE;
+}
+
+static void
+update_text (NdNotificationBox *notification_box)
+{
+        const char    *body;
+        char          *str;
+        char          *quoted;
+        GtkRequisition req;
+        int            summary_width;
+
         /* summary */
         quoted = g_markup_escape_text (nd_notification_get_summary (notification_box->priv->notification), -1);
         str = g_strdup_printf ("<b><big>%s</big></b>", quoted);
@@ -221,16 +329,26 @@ update_notification_box (NdNotificationBox *notification_box)
                                      -1);
 
         /* body */
-        gtk_label_set_markup (GTK_LABEL (notification_box->priv->body_label), nd_notification_get_body (notification_box->priv->notification));
+        body = nd_notification_get_body (notification_box->priv->notification);
+        gtk_label_set_markup (GTK_LABEL (notification_box->priv->body_label), body);
 
-        if (str != NULL && *str != '\0') {
+        notification_box->priv->have_body = FALSE;
+        if (body != NULL && *body != '\0') {
                 gtk_widget_set_size_request (notification_box->priv->body_label,
                                              summary_width,
                                              -1);
-                have_body = TRUE;
+                notification_box->priv->have_body = TRUE;
         }
+}
+
+static void
+update_actions (NdNotificationBox *notification_box)
+{
+        char **actions;
+        int    i;
+
+        notification_box->priv->have_actions = FALSE;
 
-        /* actions */
         gtk_container_foreach (GTK_CONTAINER (notification_box->priv->actions_box), remove_item, NULL);
         actions = nd_notification_get_actions (notification_box->priv->notification);
         for (i = 0; actions[i] != NULL; i += 2) {
@@ -254,15 +372,28 @@ update_notification_box (NdNotificationBox *notification_box)
                                                              actions[i]);
                         gtk_box_pack_start (GTK_BOX (notification_box->priv->actions_box), button, FALSE, FALSE, 0);
 
-                        have_actions = TRUE;
+                        notification_box->priv->have_actions = TRUE;
                 }
         }
+}
 
-        if (have_icon || have_body || have_actions) {
-                gtk_widget_show (notification_box->priv->content_hbox);
-        } else {
-                gtk_widget_hide (notification_box->priv->content_hbox);
+static void
+update_notification_box (NdNotificationBox *notification_box,
+                         guint              changes)
+{
+        if (changes & ND_NOTIFICATION_CHANGED_IMAGE) {
+                notification_box->priv->have_icon = update_image (notification_box);
+        }
+
+        if (changes & (ND_NOTIFICATION_CHANGED_SUMMARY | ND_NOTIFICATION_CHANGED_BODY)) {
+                update_text (notification_box);
+        }
+
+        if (changes & ND_NOTIFICATION_CHANGED_ACTIONS) {
+                update_actions (notification_box);
         }
+
+        update_content_hbox_visibility (notification_box);
 }
 
 static void
@@ -291,7 +422,11 @@ nd_notification_box_init (NdNotificationBox *notification_box)
                             FALSE, FALSE, 0);
         gtk_widget_set_size_request (iconbox, BODY_X_OFFSET, -1);
 
-        notification_box->priv->icon = gtk_image_new ();
+        notification_box->priv->icon = gtk_drawing_area_new ();
+        g_signal_connect (notification_box->priv->icon,
+                          "draw",
+                          G_CALLBACK (on_icon_draw),
+                          notification_box);
         gtk_widget_show (notification_box->priv->icon);
         gtk_container_add (GTK_CONTAINER (iconbox), notification_box->priv->icon);
 
@@ -370,9 +505,18 @@ nd_notification_box_init (NdNotificationBox *notification_box)
 
 static void
 on_notification_changed (NdNotification    *notification,
+                         guint              changes,
                          NdNotificationBox *notification_box)
 {
-        update_notification_box (notification_box);
+        update_notification_box (notification_box, changes);
+}
+
+static void
+nd_notification_box_destroy (GtkWidget *widget)
+{
+        cancel_image_load (ND_NOTIFICATION_BOX (widget));
+
+        GTK_WIDGET_CLASS (nd_notification_box_parent_class)->destroy (widget);
 }
 
 static void
@@ -387,6 +531,12 @@ nd_notification_box_finalize (GObject *object)
 
         g_return_if_fail (notification_box->priv != NULL);
 
+        cancel_image_load (notification_box);
+
+        if (notification_box->priv->icon_surface != NULL) {
+                cairo_surface_destroy (notification_box->priv->icon_surface);
+        }
+
         g_signal_handlers_disconnect_by_func (notification_box->priv->notification, G_CALLBACK (on_notification_changed), notification_box);
 
         g_object_unref (notification_box->priv->notification);
@@ -404,7 +554,7 @@ nd_notification_box_new_for_notification (NdNotification *notification)
                                          NULL);
         notification_box->priv->notification = g_object_ref (notification);
         g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), notification_box);
-        update_notification_box (notification_box);
+        update_notification_box (notification_box, ND_NOTIFICATION_CHANGED_ALL);
 
         return notification_box;
 }
@@ -19,11 +19,15 @@
 
 #include "config.h"
 
+#include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 
 #include "nd-notification.h"
+#include "nd-image-cache.h"
+#include "nd-pixops.h"
 
 #define ND_NOTIFICATION_CLASS(klass) (G_TYPE_CHECK_CLASS_CAST ((klass), ND_TYPE_NOTIFICATION, NdNotificationClass))
 #define ND_IS_NOTIFICATION_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), ND_TYPE_NOTIFICATION))
@@ -36,6 +40,99 @@ enum {
         LAST_SIGNAL
 };
 
+/* The hints defined by the specification, and the ones this daemon
+ * looks at, are parsed once into typed fields. */
+typedef enum {
+        HINT_URGENCY,
+        HINT_CATEGORY,
+        HINT_TRANSIENT,
+        HINT_RESIDENT,
+        HINT_ACTION_ICONS,
+        HINT_IMAGE_DATA,
+        HINT_IMAGE_DATA_COMPAT,
+        HINT_IMAGE_PATH,
+        HINT_IMAGE_PATH_COMPAT,
+        HINT_ICON_DATA,
+        HINT_SOUND_FILE,
+        HINT_SOUND_NAME,
+        HINT_SUPPRESS_SOUND,
+        HINT_DESKTOP_ENTRY,
+        HINT_VALUE,
+        HINT_SYNCHRONOUS_CANONICAL,
+        HINT_SYNCHRONOUS,
+        N_HINTS
+} Hint;
+
+/* Perfect hash of the known hint names, from their length and two of
+ * their characters.  The multipliers were searched for offline so that
+ * no two names share a slot of hint_keys; a hit still has to compare
+ * equal to the name in the slot. */
+#define HINT_MIN_LENGTH 5
+#define HINT_MAX_LENGTH 31
+#define HINT_HASH(key, len) (((len)                                  \
+                              + 6 * (guchar) (key)[(len) / 2]        \
+                              + 11 * (guchar) (key)[(len) - 4]) & 31)
+
+static const struct {
+        const char *name;
+        Hint        hint;
+} hint_keys[32] = {
+        { NULL, 0 },
+        { NULL, 0 },
+        { NULL, 0 },
+        { NULL, 0 },
+        { "image-data", HINT_IMAGE_DATA },
+        { "suppress-sound", HINT_SUPPRESS_SOUND },
+        { NULL, 0 },
+        { "desktop-entry", HINT_DESKTOP_ENTRY },
+        { "image-path", HINT_IMAGE_PATH },
+        { NULL, 0 },
+        { NULL, 0 },
+        { NULL, 0 },
+        { "resident", HINT_RESIDENT },
+        { NULL, 0 },
+        { NULL, 0 },
+        { "icon_data", HINT_ICON_DATA },
+        { "image_data", HINT_IMAGE_DATA_COMPAT },
+        { "synchronous", HINT_SYNCHRONOUS },
+        { "sound-name", HINT_SOUND_NAME },
+        { NULL, 0 },
+        { "image_path", HINT_IMAGE_PATH_COMPAT },
+        { NULL, 0 },
+        { NULL, 0 },
+        { NULL, 0 },
+        { "value", HINT_VALUE },
+        { NULL, 0 },
+        { "sound-file", HINT_SOUND_FILE },
+        { "action-icons", HINT_ACTION_ICONS },
+        { "urgency", HINT_URGENCY },
+        { "x-canonical-private-synchronous", HINT_SYNCHRONOUS_CANONICAL },
+        { "transient", HINT_TRANSIENT },
+        { "category", HINT_CATEGORY },
+};
+
+/* what a change of each hint means for the views */
+static const guint hint_changes[N_HINTS] = {
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* urgency */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* category */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* transient */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* resident */
+        /* the action buttons show either icons or labels */
+        ND_NOTIFICATION_CHANGED_HINTS | ND_NOTIFICATION_CHANGED_ACTIONS, /* action-icons */
+        ND_NOTIFICATION_CHANGED_IMAGE_DATA,                             /* image-data */
+        ND_NOTIFICATION_CHANGED_IMAGE_DATA,                             /* image_data */
+        ND_NOTIFICATION_CHANGED_IMAGE_PATH,                             /* image-path */
+        ND_NOTIFICATION_CHANGED_IMAGE_PATH,                             /* image_path */
+        ND_NOTIFICATION_CHANGED_ICON_DATA,                              /* icon_data */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* sound-file */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* sound-name */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* suppress-sound */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* desktop-entry */
+        ND_NOTIFICATION_CHANGED_VALUE,                                  /* value */
+        ND_NOTIFICATION_CHANGED_HINTS,                                  /* x-canonical-private-synchronous */
+        ND_NOTIFICATION_CHANGED_HINTS                                   /* synchronous */
+};
+
 struct _NdNotification {
         GObject       parent;
 
@@ -50,8 +147,33 @@ struct _NdNotification {
         char         *summary;
         char         *body;
         char        **actions;
-        GHashTable   *hints;
         int           timeout;
+
+        /* known hints by Hint, and the others as one a{sv} or NULL */
+        GVariant     *hints[N_HINTS];
+        GVariant     *other_hints;
+
+        /* parsed from hints, strings point into them */
+        guint8        urgency;
+        const char   *category;
+        gboolean      transient;
+        gboolean      resident;
+        gboolean      action_icons;
+        GVariant     *image_data;
+        const char   *image_path;
+        GVariant     *icon_data;
+        const char   *sound_file;
+        const char   *sound_name;
+        gboolean      suppress_sound;
+        const char   *desktop_entry;
+        int           value;
+        const char   *synchronous;
+
+        /* decoded image shared by all views, for image_size */
+        guint         image_serial;
+        gboolean      image_loaded;
+        int           image_size;
+        cairo_surface_t *image;
 };
 
 static void nd_notification_finalize     (GObject      *object);
@@ -91,8 +213,8 @@ nd_notification_class_init (NdNotificationClass *class)
                               G_SIGNAL_RUN_LAST,
                               0,
                               NULL, NULL,
-                              g_cclosure_marshal_VOID__VOID,
-                              G_TYPE_NONE, 0);
+                              g_cclosure_marshal_VOID__UINT,
+                              G_TYPE_NONE, 1, G_TYPE_UINT);
         signals [CLOSED] =
                 g_signal_new ("closed",
                               G_TYPE_FROM_CLASS (class),
@@ -121,16 +243,15 @@ nd_notification_init (NdNotification *notification)
         notification->summary = NULL;
         notification->body = NULL;
         notification->actions = NULL;
-        notification->hints = g_hash_table_new_full (g_str_hash,
-                                                     g_str_equal,
-                                                     g_free,
-                                                     (GDestroyNotify) g_variant_unref);
+        notification->urgency = 1;
+        notification->value = -1;
 }
 
 static void
 nd_notification_finalize (GObject *object)
 {
         NdNotification *notification;
+        int             i;
 
         notification = ND_NOTIFICATION (object);
 
@@ -141,14 +262,294 @@ nd_notification_finalize (GObject *object)
         g_free (notification->body);
         g_strfreev (notification->actions);
 
-        if (notification->hints != NULL) {
-                g_hash_table_destroy (notification->hints);
+        for (i = 0; i < N_HINTS; i++) {
+                if (notification->hints[i] != NULL) {
+                        g_variant_unref (notification->hints[i]);
+                }
+        }
+
+        if (notification->other_hints != NULL) {
+                g_variant_unref (notification->other_hints);
+        }
+
+        if (notification->image != NULL) {
+                cairo_surface_destroy (notification->image);
         }
 
         if (G_OBJECT_CLASS (nd_notification_parent_class)->finalize)
                 (*G_OBJECT_CLASS (nd_notification_parent_class)->finalize) (object);
 }
 
+static gboolean
+replace_string (char       **field,
+                const char  *value)
+{
+        if (g_strcmp0 (*field, value) == 0) {
+                return FALSE;
+        }
+
+        g_free (*field);
+        *field = g_strdup (value);
+
+        return TRUE;
+}
+
+static gboolean
+strv_equal (char       **a,
+            const char **b)
+{
+        int i;
+
+        if (a == NULL || b == NULL) {
+                return (a == NULL || a[0] == NULL) && (b == NULL || b[0] == NULL);
+        }
+
+        for (i = 0; a[i] != NULL && b[i] != NULL; i++) {
+                if (strcmp (a[i], b[i]) != 0) {
+                        return FALSE;
+                }
+        }
+
+        return a[i] == NULL && b[i] == NULL;
+}
+
+/* Image hints can be megabytes and one resolved from an image-fd
+ * hint is not serialized, which g_variant_get_data() would do with a
+ * copy of the whole mapping, so their fields are compared one by one
+ * and the pixels only when they are not the same memory. */
+static gboolean
+image_hint_equal (GVariant *a,
+                  GVariant *b)
+{
+        int           width[2], height[2], rowstride[2];
+        int           bits_per_sample[2], n_channels[2];
+        gboolean      has_alpha[2];
+        GVariant     *pixels[2];
+        gconstpointer data[2];
+        gsize         size[2];
+        gboolean      equal;
+
+        g_variant_get (a, "(iiibii@ay)",
+                       &width[0], &height[0], &rowstride[0], &has_alpha[0],
+                       &bits_per_sample[0], &n_channels[0], &pixels[0]);
+        g_variant_get (b, "(iiibii@ay)",
+                       &width[1], &height[1], &rowstride[1], &has_alpha[1],
+                       &bits_per_sample[1], &n_channels[1], &pixels[1]);
+
+        data[0] = g_variant_get_fixed_array (pixels[0], &size[0], 1);
+        data[1] = g_variant_get_fixed_array (pixels[1], &size[1], 1);
+
+        equal = width[0] == width[1]
+                && height[0] == height[1]
+                && rowstride[0] == rowstride[1]
+                && ! has_alpha[0] == ! has_alpha[1]
+                && bits_per_sample[0] == bits_per_sample[1]
+                && n_channels[0] == n_channels[1]
+                && size[0] == size[1]
+                && (data[0] == data[1] || memcmp (data[0], data[1], size[0]) == 0);
+
+        g_variant_unref (pixels[0]);
+        g_variant_unref (pixels[1]);
+
+        return equal;
+}
+
+/* The other hints are small, their serialized bytes are compared
+ * directly, which mostly stops at the size. */
+static gboolean
+hint_equal (GVariant *a,
+            GVariant *b)
+{
+        gsize size;
+
+        if (a == NULL || b == NULL) {
+                return a == b;
+        }
+
+        if (a == b) {
+                return TRUE;
+        }
+
+        if (! g_variant_type_equal (g_variant_get_type (a), g_variant_get_type (b))) {
+                return FALSE;
+        }
+
+        if (g_variant_is_of_type (a, G_VARIANT_TYPE ("(iiibiiay)"))) {
+                return image_hint_equal (a, b);
+        }
+
+        size = g_variant_get_size (a);
+        if (size != g_variant_get_size (b)) {
+                return FALSE;
+        }
+
+        return memcmp (g_variant_get_data (a), g_variant_get_data (b), size) == 0;
+}
+
+static int
+lookup_hint (const char *key)
+{
+        gsize len;
+        int   slot;
+
+        len = strlen (key);
+        if (len < HINT_MIN_LENGTH || len > HINT_MAX_LENGTH) {
+                return -1;
+        }
+
+        slot = HINT_HASH (key, len);
+        if (hint_keys[slot].name == NULL || strcmp (hint_keys[slot].name, key) != 0) {
+                return -1;
+        }
+
+        return hint_keys[slot].hint;
+}
+
+static gboolean
+get_boolean_hint (GVariant *value)
+{
+        return value != NULL
+                && g_variant_is_of_type (value, G_VARIANT_TYPE_BOOLEAN)
+                && g_variant_get_boolean (value);
+}
+
+static const char *
+get_string_hint (GVariant *value)
+{
+        if (value == NULL || ! g_variant_is_of_type (value, G_VARIANT_TYPE_STRING)) {
+                return NULL;
+        }
+
+        return g_variant_get_string (value, NULL);
+}
+
+static void
+parse_hints (NdNotification *notification)
+{
+        GVariant **hints = notification->hints;
+        GVariant  *value;
+
+        notification->urgency = 1;
+        if (hints[HINT_URGENCY] != NULL
+            && g_variant_is_of_type (hints[HINT_URGENCY], G_VARIANT_TYPE_BYTE)) {
+                notification->urgency = g_variant_get_byte (hints[HINT_URGENCY]);
+        }
+
+        notification->category = get_string_hint (hints[HINT_CATEGORY]);
+        notification->transient = get_boolean_hint (hints[HINT_TRANSIENT]);
+        notification->resident = get_boolean_hint (hints[HINT_RESIDENT]);
+        notification->action_icons = get_boolean_hint (hints[HINT_ACTION_ICONS]);
+
+        notification->image_data = hints[HINT_IMAGE_DATA] != NULL ? hints[HINT_IMAGE_DATA] : hints[HINT_IMAGE_DATA_COMPAT];
+
+        value = hints[HINT_IMAGE_PATH] != NULL ? hints[HINT_IMAGE_PATH] : hints[HINT_IMAGE_PATH_COMPAT];
+        notification->image_path = get_string_hint (value);
+        if (value != NULL && notification->image_path == NULL) {
+                g_warning ("Expected image_path hint to be of type string");
+        }
+
+        notification->icon_data = hints[HINT_ICON_DATA];
+        if (notification->icon_data != NULL) {
+                g_warning("\"icon_data\" hint is deprecated, please use \"image_data\" instead");
+        }
+
+        notification->sound_file = get_string_hint (hints[HINT_SOUND_FILE]);
+        notification->sound_name = get_string_hint (hints[HINT_SOUND_NAME]);
+        notification->suppress_sound = get_boolean_hint (hints[HINT_SUPPRESS_SOUND]);
+        notification->desktop_entry = get_string_hint (hints[HINT_DESKTOP_ENTRY]);
+
+        notification->value = -1;
+        value = hints[HINT_VALUE];
+        if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_INT32)) {
+                notification->value = CLAMP (g_variant_get_int32 (value), 0, 100);
+        } else if (value != NULL && g_variant_is_of_type (value, G_VARIANT_TYPE_UINT32)) {
+                notification->value = MIN (g_variant_get_uint32 (value), 100);
+        }
+
+        notification->synchronous = get_string_hint (hints[HINT_SYNCHRONOUS_CANONICAL]);
+        if (notification->synchronous == NULL) {
+                notification->synchronous = get_string_hint (hints[HINT_SYNCHRONOUS]);
+        }
+}
+
+/* Replaces the hints with the ones of hints_iter and returns what
+ * changed. */
+static guint
+update_hints (NdNotification *notification,
+              GVariantIter   *hints_iter)
+{
+        GVariant        *hints[N_HINTS] = { NULL, };
+        GVariantBuilder *other;
+        GVariant        *other_hints;
+        GVariant        *item;
+        guint            changes;
+        int              i;
+
+        other = NULL;
+
+        while ((item = g_variant_iter_next_value (hints_iter))) {
+                const char *key;
+                GVariant   *value;
+                int         hint;
+
+                g_variant_get (item,
+                               "{&sv}",
+                               &key,
+                               &value);
+
+                hint = lookup_hint (key);
+                if (hint >= 0) {
+                        /* the last one wins */
+                        if (hints[hint] != NULL) {
+                                g_variant_unref (hints[hint]);
+                        }
+                        hints[hint] = value; /* steals value */
+                } else {
+                        if (other == NULL) {
+                                other = g_variant_builder_new (G_VARIANT_TYPE ("a{sv}"));
+                        }
+                        g_variant_builder_add_value (other, item);
+                        g_variant_unref (value);
+                }
+                g_variant_unref (item);
+        }
+
+        other_hints = NULL;
+        if (other != NULL) {
+                other_hints = g_variant_ref_sink (g_variant_builder_end (other));
+                g_variant_builder_unref (other);
+        }
+
+        changes = 0;
+
+        for (i = 0; i < N_HINTS; i++) {
+                if (! hint_equal (notification->hints[i], hints[i])) {
+                        changes |= hint_changes[i];
+                }
+
+                if (notification->hints[i] != NULL) {
+                        g_variant_unref (notification->hints[i]);
+                }
+                notification->hints[i] = hints[i];
+        }
+
+        if (! hint_equal (notification->other_hints, other_hints)) {
+                changes |= ND_NOTIFICATION_CHANGED_HINTS;
+        }
+
+        if (notification->other_hints != NULL) {
+                g_variant_unref (notification->other_hints);
+        }
+        notification->other_hints = other_hints;
+
+        parse_hints (notification);
+
+        return changes;
+}
+
+/* Only the fields that differ are replaced, and the "changed" signal
+ * tells the views which ones, so that replacing a notification with
+ * the same content costs next to nothing. */
 gboolean
 nd_notification_update (NdNotification *notification,
                         const char     *app_name,
@@ -159,42 +560,58 @@ nd_notification_update (NdNotification *notification,
                         GVariantIter   *hints_iter,
                         int             timeout)
 {
-        GVariant *item;
+        guint changes;
 
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        g_free (notification->app_name);
-        notification->app_name = g_strdup (app_name);
+        changes = 0;
 
-        g_free (notification->icon);
-        notification->icon = g_strdup (icon);
+        if (replace_string (&notification->app_name, app_name)) {
+                changes |= ND_NOTIFICATION_CHANGED_APP_NAME;
+        }
 
-        g_free (notification->summary);
-        notification->summary = g_strdup (summary);
+        if (replace_string (&notification->icon, icon)) {
+                changes |= ND_NOTIFICATION_CHANGED_ICON;
+        }
 
-        g_free (notification->body);
-        notification->body = g_strdup (body);
+        if (replace_string (&notification->summary, summary)) {
+                changes |= ND_NOTIFICATION_CHANGED_SUMMARY;
+        }
 
-        g_strfreev (notification->actions);
-        notification->actions = g_strdupv ((char **)actions);
+        if (replace_string (&notification->body, body)) {
+                changes |= ND_NOTIFICATION_CHANGED_BODY;
+        }
 
-        g_hash_table_remove_all (notification->hints);
+        if (notification->actions == NULL
+            || ! strv_equal (notification->actions, actions)) {
+                g_strfreev (notification->actions);
+                notification->actions = g_strdupv ((char **)actions);
+                changes |= ND_NOTIFICATION_CHANGED_ACTIONS;
+        }
 
-        while ((item = g_variant_iter_next_value (hints_iter))) {
-                const char *key;
-                GVariant   *value;
+        if (notification->timeout != timeout) {
+                notification->timeout = timeout;
+                changes |= ND_NOTIFICATION_CHANGED_TIMEOUT;
+        }
 
-                g_variant_get (item,
-                               "{sv}",
-                               &key,
-                               &value);
+        changes |= update_hints (notification, hints_iter);
+
+        /* the views reload the image when they get notified */
+        if (changes & ND_NOTIFICATION_CHANGED_IMAGE) {
+                if (notification->image != NULL) {
+                        cairo_surface_destroy (notification->image);
+                        notification->image = NULL;
+                }
+                notification->image_loaded = FALSE;
+                notification->image_serial++;
+        }
 
-                g_hash_table_insert (notification->hints,
-                                     g_strdup (key),
-                                     value); /* steals value */
+        if (changes != 0) {
+                g_signal_emit (notification, signals[CHANGED], 0, changes);
         }
 
-        g_signal_emit (notification, signals[CHANGED], 0);
+        /* replacing a closed notification brings it back */
+        notification->is_closed = FALSE;
 
         g_get_current_time (&notification->update_time);
 
@@ -226,52 +643,93 @@ nd_notification_get_is_closed (NdNotification *notification)
 gboolean
 nd_notification_get_is_transient (NdNotification *notification)
 {
-        gboolean  ret;
-        GVariant *value;
-
-        ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "transient");
-        if (value != NULL) {
-                ret = g_variant_get_boolean (value);
-        }
-
-        return ret;
+        return notification->transient;
 }
 
 gboolean
 nd_notification_get_is_resident (NdNotification *notification)
 {
-        gboolean  ret;
-        GVariant *value;
-
-        ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "resident");
-        if (value != NULL) {
-                ret = g_variant_get_boolean (value);
-        }
-
-        return ret;
+        return notification->resident;
 }
 
 gboolean
 nd_notification_get_action_icons (NdNotification *notification)
 {
-        gboolean  ret;
-        GVariant *value;
-
-        ret = FALSE;
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        value = g_hash_table_lookup (notification->hints, "action-icons");
-        if (value != NULL) {
-                ret = g_variant_get_boolean (value);
-        }
+        return notification->action_icons;
+}
+
+/* Returns the percentage of the "value" hint, or -1 if there is none */
+int
+nd_notification_get_value (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), -1);
+
+        return notification->value;
+}
+
+/* Notifications of a sender with the same synchronous tag replace each
+ * other, like the volume or brightness popups. */
+const char *
+nd_notification_get_synchronous (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return notification->synchronous;
+}
+
+/* 0 is low, 1 normal and 2 critical */
+guint8
+nd_notification_get_urgency (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), 1);
+
+        return notification->urgency;
+}
+
+const char *
+nd_notification_get_category (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return notification->category;
+}
+
+const char *
+nd_notification_get_desktop_entry (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return notification->desktop_entry;
+}
+
+const char *
+nd_notification_get_sound_file (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return notification->sound_file;
+}
+
+const char *
+nd_notification_get_sound_name (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+
+        return notification->sound_name;
+}
+
+gboolean
+nd_notification_get_suppress_sound (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
 
-        return ret;
+        return notification->suppress_sound;
 }
 
 guint32
@@ -282,12 +740,26 @@ nd_notification_get_id (NdNotification *notification)
         return notification->id;
 }
 
-GHashTable *
-nd_notification_get_hints (NdNotification *notification)
+/* Returns a new reference to the value of any hint, or NULL */
+GVariant *
+nd_notification_get_hint (NdNotification *notification,
+                          const char     *key)
 {
+        int hint;
+
         g_return_val_if_fail (ND_IS_NOTIFICATION (notification), NULL);
+        g_return_val_if_fail (key != NULL, NULL);
+
+        hint = lookup_hint (key);
+        if (hint >= 0) {
+                return notification->hints[hint] != NULL ? g_variant_ref (notification->hints[hint]) : NULL;
+        }
+
+        if (notification->other_hints == NULL) {
+                return NULL;
+        }
 
-        return notification->hints;
+        return g_variant_lookup_value (notification->other_hints, key, NULL);
 }
 
 char **
@@ -322,6 +794,14 @@ nd_notification_get_body (NdNotification *notification)
         return notification->body;
 }
 
+int
+nd_notification_get_timeout (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), -1);
+
+        return notification->timeout;
+}
+
 const char *
 nd_notification_get_icon (NdNotification *notification)
 {
@@ -331,21 +811,47 @@ nd_notification_get_icon (NdNotification *notification)
 }
 
 
-static GdkPixbuf *
-scale_pixbuf (GdkPixbuf *pixbuf,
-              int        max_width,
-              int        max_height,
-              gboolean   no_stretch_hint)
+/* Converts pixbuf to the surface the views paint, or returns NULL */
+static cairo_surface_t *
+surface_from_pixbuf (GdkPixbuf *pixbuf)
 {
-        int        pw;
-        int        ph;
-        float      scale_factor_x = 1.0;
-        float      scale_factor_y = 1.0;
-        float      scale_factor = 1.0;
+        cairo_surface_t *surface;
+
+        surface = nd_pixops_surface_from_pixbuf (pixbuf);
+        if (surface != NULL && cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+                cairo_surface_destroy (surface);
+                surface = NULL;
+        }
+
+        return surface;
+}
+
+/* Like surface_from_pixbuf(), with the image scaled to fit in
+ * max_width x max_height first.  Shrinking is done by
+ * nd_pixops_scale_down(), which writes the surface in the same pass. */
+static cairo_surface_t *
+scaled_surface_from_pixbuf (GdkPixbuf *pixbuf,
+                            int        max_width,
+                            int        max_height,
+                            gboolean   no_stretch_hint)
+{
+        cairo_surface_t *surface;
+        int              pw;
+        int              ph;
+        float            scale_factor_x = 1.0;
+        float            scale_factor_y = 1.0;
+        float            scale_factor = 1.0;
 
         pw = gdk_pixbuf_get_width (pixbuf);
         ph = gdk_pixbuf_get_height (pixbuf);
 
+        /* nothing to do if it already fits */
+        if ((pw == max_width && ph <= max_height)
+            || (ph == max_height && pw <= max_width)
+            || (no_stretch_hint && pw <= max_width && ph <= max_height)) {
+                return surface_from_pixbuf (pixbuf);
+        }
+
         /* Determine which dimension requires the smallest scale. */
         scale_factor_x = (float) max_width / (float) pw;
         scale_factor_y = (float) max_height / (float) ph;
@@ -361,20 +867,45 @@ scale_pixbuf (GdkPixbuf *pixbuf,
                 int scale_x;
                 int scale_y;
 
-                scale_x = (int) (pw * scale_factor);
-                scale_y = (int) (ph * scale_factor);
-                return gdk_pixbuf_scale_simple (pixbuf,
-                                                scale_x,
-                                                scale_y,
-                                                GDK_INTERP_BILINEAR);
+                scale_x = MAX ((int) (pw * scale_factor + 0.5), 1);
+                scale_y = MAX ((int) (ph * scale_factor + 0.5), 1);
+
+                if (scale_factor < 1.0) {
+                        surface = nd_pixops_scale_down (pixbuf, scale_x, scale_y);
+                        if (surface != NULL && cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+                                cairo_surface_destroy (surface);
+                                surface = NULL;
+                        }
+                } else {
+                        GdkPixbuf *scaled;
+
+                        surface = NULL;
+                        scaled = gdk_pixbuf_scale_simple (pixbuf,
+                                                          scale_x,
+                                                          scale_y,
+                                                          GDK_INTERP_BILINEAR);
+                        if (scaled != NULL) {
+                                surface = surface_from_pixbuf (scaled);
+                                g_object_unref (scaled);
+                        }
+                }
+
+                return surface;
         } else {
-                return g_object_ref (pixbuf);
+                return surface_from_pixbuf (pixbuf);
         }
 }
 
-static GdkPixbuf *
-_notify_daemon_pixbuf_from_data_hint (GVariant *icon_data,
-                                      int       size)
+static void
+release_variant_data (guchar   *pixels,
+                      gpointer  data)
+{
+        g_variant_unref ((GVariant *) data);
+}
+
+static cairo_surface_t *
+_notify_daemon_surface_from_data_hint (GVariant *icon_data,
+                                       int       size)
 {
         gboolean        has_alpha;
         int             bits_per_sample;
@@ -383,9 +914,12 @@ _notify_daemon_pixbuf_from_data_hint (GVariant *icon_data,
         int             rowstride;
         int             n_channels;
         GVariant       *data_variant;
-        gsize           expected_len;
-        guchar         *data;
+        guint64         row_len;
+        guint64         expected_len;
         GdkPixbuf      *pixbuf;
+        cairo_surface_t *surface;
+        guint64         hash;
+        char           *geometry;
 
         g_variant_get (icon_data,
                        "(iiibii@ay)",
@@ -397,118 +931,530 @@ _notify_daemon_pixbuf_from_data_hint (GVariant *icon_data,
                        &n_channels,
                        &data_variant);
 
-        expected_len = (height - 1) * rowstride + width
-                * ((n_channels * bits_per_sample + 7) / 8);
+        /* 1 to 4 channels of 8 or 16 bits, the alpha channel being
+           the last one of 2 and 4 channel images */
+        if (width <= 0
+            || height <= 0
+            || rowstride <= 0
+            || (bits_per_sample != 8 && bits_per_sample != 16)
+            || n_channels < 1
+            || n_channels > 4
+            || has_alpha != (n_channels == 2 || n_channels == 4)) {
+                g_warning ("Unsupported image data: %dx%d, %d channels of %d bits%s",
+                           width,
+                           height,
+                           n_channels,
+                           bits_per_sample,
+                           has_alpha ? " with alpha" : "");
+                g_variant_unref (data_variant);
+                return NULL;
+        }
+
+        /* computed in 64 bits, so huge sizes can not wrap around */
+        row_len = (guint64) width * n_channels * (bits_per_sample / 8);
+        if (row_len > (guint64) rowstride) {
+                g_warning ("Image data rowstride %d is too small for a row of %"
+                           G_GUINT64_FORMAT " bytes",
+                           rowstride,
+                           row_len);
+                g_variant_unref (data_variant);
+                return NULL;
+        }
+
+        expected_len = (guint64) (height - 1) * rowstride + row_len;
 
         if (expected_len != g_variant_get_size (data_variant)) {
-                g_warning ("Expected image data to be of length %" G_GSIZE_FORMAT
+                g_warning ("Expected image data to be of length %" G_GUINT64_FORMAT
                            " but got a " "length of %" G_GSIZE_FORMAT,
                            expected_len,
                            g_variant_get_size (data_variant));
+                g_variant_unref (data_variant);
                 return NULL;
         }
 
-        data = (guchar *) g_memdup (g_variant_get_data (data_variant),
-                                    g_variant_get_size (data_variant));
-
-        pixbuf = gdk_pixbuf_new_from_data (data,
-                                           GDK_COLORSPACE_RGB,
-                                           has_alpha,
-                                           bits_per_sample,
-                                           width,
-                                           height,
-                                           rowstride,
-                                           (GdkPixbufDestroyNotify) g_free,
-                                           NULL);
-        if (pixbuf != NULL && size > 0) {
-                GdkPixbuf *scaled;
-                scaled = scale_pixbuf (pixbuf, size, size, TRUE);
+        /* Identical images, like the avatar sent along with every
+           chat message, are recognized by their content and only
+           converted and scaled once. */
+        hash = nd_image_cache_hash (g_variant_get_data (data_variant), expected_len, 0);
+        geometry = g_strdup_printf ("%dx%d:%d:%d:%d:%d",
+                                    width,
+                                    height,
+                                    rowstride,
+                                    has_alpha,
+                                    bits_per_sample,
+                                    n_channels);
+
+        surface = nd_image_cache_lookup_data (g_variant_get_data (data_variant),
+                                              expected_len,
+                                              hash,
+                                              geometry,
+                                              size);
+        if (surface != NULL) {
+                g_variant_unref (data_variant);
+                g_free (geometry);
+                return surface;
+        }
+
+        if (bits_per_sample == 8 && n_channels >= 3) {
+                /* The pixbuf borrows the pixels of the hint and keeps the
+                   variant alive, so the image is not copied just to be
+                   scaled and converted. */
+                pixbuf = gdk_pixbuf_new_from_data (g_variant_get_data (data_variant),
+                                                   GDK_COLORSPACE_RGB,
+                                                   has_alpha,
+                                                   bits_per_sample,
+                                                   width,
+                                                   height,
+                                                   rowstride,
+                                                   release_variant_data,
+                                                   g_variant_ref (data_variant));
+                if (pixbuf == NULL) {
+                        g_variant_unref (data_variant);
+                }
+        } else {
+                /* gdk-pixbuf only knows about 8 bit RGB(A) */
+                pixbuf = nd_pixops_pixbuf_from_data (g_variant_get_data (data_variant),
+                                                     width,
+                                                     height,
+                                                     rowstride,
+                                                     n_channels,
+                                                     bits_per_sample);
+        }
+
+        /* The surface has pixels of its own, so neither the message
+           nor an image-fd mapping outlive the pixbuf. */
+        if (pixbuf != NULL) {
+                if (size > 0) {
+                        surface = scaled_surface_from_pixbuf (pixbuf, size, size, TRUE);
+                } else {
+                        surface = surface_from_pixbuf (pixbuf);
+                }
                 g_object_unref (pixbuf);
-                pixbuf = scaled;
         }
 
-        return pixbuf;
+        if (surface != NULL) {
+                nd_image_cache_add_data (g_variant_get_data (data_variant),
+                                         expected_len,
+                                         hash,
+                                         geometry,
+                                         size,
+                                         surface);
+        }
+        g_variant_unref (data_variant);
+        g_free (geometry);
+
+        return surface;
 }
 
-static GdkPixbuf *
-_notify_daemon_pixbuf_from_path (const char *path,
-                                 int         size)
+typedef struct
+{
+        guint         serial;
+        int           size;
+        GCancellable *cancellable;
+
+        /* what to load, resolved on the main thread */
+        GVariant     *data;
+        char         *path;
+        char         *filename;
+        char         *icon_filename;
+        int           icon_size;
+        gboolean      icon_builtin;
+
+        /* shared with the cache and every view showing the image */
+        cairo_surface_t *surface;
+        gboolean      from_theme;
+} ImageLoad;
+
+static void
+image_load_free (ImageLoad *load)
+{
+        if (load->cancellable != NULL) {
+                g_object_unref (load->cancellable);
+        }
+        if (load->data != NULL) {
+                g_variant_unref (load->data);
+        }
+        if (load->surface != NULL) {
+                cairo_surface_destroy (load->surface);
+        }
+        g_free (load->path);
+        g_free (load->filename);
+        g_free (load->icon_filename);
+        g_free (load);
+}
+
+static void
+prepare_path_load (ImageLoad  *load,
+                   const char *path)
 {
         GFile *file;
-        GdkPixbuf *pixbuf = NULL;
+
+        load->path = g_strdup (path);
 
         file = g_file_new_for_commandline_arg (path);
         if (g_file_is_native (file)) {
-                char *realpath;
-
-                realpath = g_file_get_path (file);
-                pixbuf = gdk_pixbuf_new_from_file_at_size (realpath, size, size, NULL);
-                g_free (realpath);
+                load->filename = g_file_get_path (file);
         }
         g_object_unref (file);
 
-        if (pixbuf == NULL) {
-                /* Load icon theme icon */
-                GtkIconTheme *theme;
-                GtkIconInfo  *icon_info;
+        /* GtkIconTheme may only be used from the main thread, so the
+           icon is looked up here and only decoded in the thread.  That
+           lookup is skipped for icons that are already cached. */
+        if (strchr (path, '/') == NULL) {
+                GtkIconInfo *icon_info;
+
+                load->surface = nd_image_cache_lookup_icon (path, load->size);
+                if (load->surface != NULL) {
+                        return;
+                }
 
-                theme = gtk_icon_theme_get_default ();
-                icon_info = gtk_icon_theme_lookup_icon (theme,
+                icon_info = gtk_icon_theme_lookup_icon (gtk_icon_theme_get_default (),
                                                         path,
-                                                        size,
+                                                        load->size,
                                                         GTK_ICON_LOOKUP_USE_BUILTIN);
 
                 if (icon_info != NULL) {
-                        gint icon_size;
+                        load->icon_size = MIN (load->size,
+                                               gtk_icon_info_get_base_size (icon_info));
 
-                        icon_size = MIN (size,
-                                         gtk_icon_info_get_base_size (icon_info));
+                        if (load->icon_size == 0)
+                                load->icon_size = load->size;
 
-                        if (icon_size == 0)
-                                icon_size = size;
-
-                        pixbuf = gtk_icon_theme_load_icon (theme,
-                                                           path,
-                                                           icon_size,
-                                                           GTK_ICON_LOOKUP_USE_BUILTIN,
-                                                           NULL);
+                        load->icon_filename = g_strdup (gtk_icon_info_get_filename (icon_info));
+                        load->icon_builtin = load->icon_filename == NULL;
 
                         gtk_icon_info_free (icon_info);
                 }
         }
+}
+
+static gboolean
+prepare_image_load (NdNotification *notification,
+                    ImageLoad      *load)
+{
+        if (notification->image_data != NULL) {
+                load->data = g_variant_ref (notification->image_data);
+        } else if (notification->image_path != NULL) {
+                prepare_path_load (load, notification->image_path);
+        } else if (*notification->icon != '\0') {
+                prepare_path_load (load, notification->icon);
+        } else if (notification->icon_data != NULL) {
+                load->data = g_variant_ref (notification->icon_data);
+        } else {
+                return FALSE;
+        }
+
+        return TRUE;
+}
+
+/* Whether the notification names an image at all, in which case the
+ * views keep room for it while it loads.  The image may still turn
+ * out to be missing or broken. */
+gboolean
+nd_notification_has_image (NdNotification *notification)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
+
+        return notification->image_data != NULL
+                || notification->image_path != NULL
+                || *notification->icon != '\0'
+                || notification->icon_data != NULL;
+}
+
+/* JPEG can be decoded at 1/2, 1/4 or 1/8 of its size for a fraction of
+ * the time and memory, so the loader is asked for the smallest of those
+ * that still covers size.  Other formats are decoded at their own size,
+ * since the loader would only scale them down with a bilinear filter. */
+static void
+on_size_prepared (GdkPixbufLoader *loader,
+                  int              width,
+                  int              height,
+                  gpointer         data)
+{
+        int              size = GPOINTER_TO_INT (data);
+        GdkPixbufFormat *format;
+        char            *name;
+        int              denom;
+
+        format = gdk_pixbuf_loader_get_format (loader);
+        name = format != NULL ? gdk_pixbuf_format_get_name (format) : NULL;
+
+        if (g_strcmp0 (name, "jpeg") == 0) {
+                for (denom = 8; denom > 1; denom /= 2) {
+                        if ((MAX (width, height) + denom - 1) / denom >= size) {
+                                break;
+                        }
+                }
+
+                /* rounded up like libjpeg does, so the loader does not
+                   have to scale what it decoded */
+                if (denom > 1) {
+                        gdk_pixbuf_loader_set_size (loader,
+                                                    (width + denom - 1) / denom,
+                                                    (height + denom - 1) / denom);
+                }
+        }
+
+        g_free (name);
+}
+
+/* Returns the image of filename decoded at about size, still to be
+ * reduced to size by scaled_surface_from_pixbuf(). */
+static GdkPixbuf *
+load_file_at_size (const char *filename,
+                   int         size)
+{
+        GdkPixbufFormat *format;
+        GdkPixbufLoader *loader;
+        GdkPixbuf       *pixbuf;
+        FILE            *f;
+        guchar           buffer[16384];
+        gsize            length;
+        gboolean         ok;
+
+        /* vector images are best rendered at the right size, the
+           others are decoded at about their size and reduced by
+           averaging */
+        format = gdk_pixbuf_get_file_info (filename, NULL, NULL);
+        if (format == NULL || gdk_pixbuf_format_is_scalable (format)) {
+                return gdk_pixbuf_new_from_file_at_size (filename, size, size, NULL);
+        }
+
+        f = g_fopen (filename, "rb");
+        if (f == NULL) {
+                return NULL;
+        }
+
+        loader = gdk_pixbuf_loader_new ();
+        g_signal_connect (loader,
+                          "size-prepared",
+                          G_CALLBACK (on_size_prepared),
+                          GINT_TO_POINTER (size));
+
+        ok = TRUE;
+        while (ok && (length = fread (buffer, 1, sizeof (buffer), f)) > 0) {
+                ok = gdk_pixbuf_loader_write (loader, buffer, length, NULL);
+        }
+        fclose (f);
+
+        /* close even after an error, the loader insists on it */
+        ok = gdk_pixbuf_loader_close (loader, NULL) && ok;
+
+        pixbuf = NULL;
+        if (ok && gdk_pixbuf_loader_get_pixbuf (loader) != NULL) {
+                pixbuf = g_object_ref (gdk_pixbuf_loader_get_pixbuf (loader));
+        }
+        g_object_unref (loader);
 
         return pixbuf;
 }
 
-GdkPixbuf *
-nd_notification_load_image (NdNotification *notification,
-                            int             size)
+static void
+load_surface (ImageLoad *load)
 {
-        GVariant  *data;
         GdkPixbuf *pixbuf;
 
-        pixbuf = NULL;
+        if (load->data != NULL) {
+                load->surface = _notify_daemon_surface_from_data_hint (load->data, load->size);
+                return;
+        }
 
-        if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "image-data"))
-            || (data = (GVariant *) g_hash_table_lookup (notification->hints, "image_data"))) {
-                pixbuf = _notify_daemon_pixbuf_from_data_hint (data, size);
-        } else if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "image-path"))
-                   || (data = (GVariant *) g_hash_table_lookup (notification->hints, "image_path"))) {
-                if (g_variant_is_of_type (data, G_VARIANT_TYPE ("(s)"))) {
-                        const char *path;
-                        path = g_variant_get_string (data, NULL);
-                        pixbuf = _notify_daemon_pixbuf_from_path (path, size);
-                } else {
-                        g_warning ("Expected image_path hint to be of type string");
+        /* a cached theme icon found on the main thread */
+        if (load->surface != NULL) {
+                return;
+        }
+
+        load->surface = nd_image_cache_lookup (load->path, load->size);
+
+        if (load->surface == NULL && load->filename != NULL) {
+                pixbuf = load_file_at_size (load->filename, load->size);
+                if (pixbuf != NULL) {
+                        load->surface = scaled_surface_from_pixbuf (pixbuf, load->size, load->size, TRUE);
+                        g_object_unref (pixbuf);
+                }
+                if (load->surface != NULL) {
+                        nd_image_cache_add (load->path,
+                                            load->size,
+                                            ND_IMAGE_SOURCE_FILE,
+                                            load->filename,
+                                            load->surface);
                 }
-        } else if (*notification->icon != '\0') {
-                pixbuf = _notify_daemon_pixbuf_from_path (notification->icon, size);
-        } else if ((data = (GVariant *) g_hash_table_lookup (notification->hints, "icon_data"))) {
-                g_warning("\"icon_data\" hint is deprecated, please use \"image_data\" instead");
-                pixbuf = _notify_daemon_pixbuf_from_data_hint (data, size);
         }
 
-        return pixbuf;
+        if (load->surface == NULL && load->icon_filename != NULL) {
+                pixbuf = gdk_pixbuf_new_from_file_at_size (load->icon_filename,
+                                                           load->icon_size,
+                                                           load->icon_size,
+                                                           NULL);
+                if (pixbuf != NULL) {
+                        load->surface = surface_from_pixbuf (pixbuf);
+                        g_object_unref (pixbuf);
+                }
+                load->from_theme = load->surface != NULL;
+        }
+}
+
+static void
+load_image_thread (GSimpleAsyncResult *result,
+                   GObject            *object,
+                   GCancellable       *cancellable)
+{
+        ImageLoad *load;
+
+        if (g_cancellable_is_cancelled (cancellable)) {
+                return;
+        }
+
+        load = g_simple_async_result_get_op_res_gpointer (result);
+
+        /* converted to the format cairo paints from once, here */
+        load_surface (load);
+}
+
+/* Gets the image of the notification, scaled to fit size, if it was
+ * already loaded.  Returns FALSE if it still has to be loaded with
+ * nd_notification_load_image_async(). */
+gboolean
+nd_notification_peek_image (NdNotification   *notification,
+                            int               size,
+                            cairo_surface_t **surface)
+{
+        g_return_val_if_fail (ND_IS_NOTIFICATION (notification), FALSE);
+        g_return_val_if_fail (surface != NULL, FALSE);
+
+        *surface = NULL;
+
+        if (! notification->image_loaded || notification->image_size != size) {
+                return FALSE;
+        }
+
+        if (notification->image != NULL) {
+                *surface = cairo_surface_reference (notification->image);
+        }
+
+        return TRUE;
+}
+
+/* Decodes the image of the notification in a worker thread, so a slow
+ * file system or a huge image never blocks the bubbles.  The image is
+ * decoded once and shared by the bubble and the dock until the
+ * notification gets updated. */
+void
+nd_notification_load_image_async (NdNotification      *notification,
+                                  int                  size,
+                                  GCancellable        *cancellable,
+                                  GAsyncReadyCallback  callback,
+                                  gpointer             user_data)
+{
+        GSimpleAsyncResult *result;
+        ImageLoad          *load;
+
+        g_return_if_fail (ND_IS_NOTIFICATION (notification));
+
+        result = g_simple_async_result_new (G_OBJECT (notification),
+                                            callback,
+                                            user_data,
+                                            nd_notification_load_image_async);
+
+        load = g_new0 (ImageLoad, 1);
+        load->serial = notification->image_serial;
+        load->size = size;
+        if (cancellable != NULL) {
+                load->cancellable = g_object_ref (cancellable);
+        }
+        g_simple_async_result_set_op_res_gpointer (result,
+                                                   load,
+                                                   (GDestroyNotify) image_load_free);
+
+        if (notification->image_loaded && notification->image_size == size) {
+                if (notification->image != NULL) {
+                        load->surface = cairo_surface_reference (notification->image);
+                }
+                g_simple_async_result_complete_in_idle (result);
+        } else if (! prepare_image_load (notification, load)
+                   || load->surface != NULL) {
+                /* no image, or a cached icon */
+                g_simple_async_result_complete_in_idle (result);
+        } else {
+                g_simple_async_result_run_in_thread (result,
+                                                     load_image_thread,
+                                                     G_PRIORITY_DEFAULT,
+                                                     cancellable);
+        }
+
+        g_object_unref (result);
+}
+
+/* Returns a new reference to the loaded image, or NULL if the
+ * notification has none.  Must be called from the main thread. */
+cairo_surface_t *
+nd_notification_load_image_finish (NdNotification  *notification,
+                                   GAsyncResult    *result,
+                                   GError         **error)
+{
+        GSimpleAsyncResult *simple;
+        ImageLoad          *load;
+
+        g_return_val_if_fail (g_simple_async_result_is_valid (result,
+                                                              G_OBJECT (notification),
+                                                              nd_notification_load_image_async),
+                              NULL);
+
+        simple = G_SIMPLE_ASYNC_RESULT (result);
+        if (g_simple_async_result_propagate_error (simple, error)) {
+                return NULL;
+        }
+
+        load = g_simple_async_result_get_op_res_gpointer (simple);
+
+        if (load->surface == NULL && load->icon_builtin) {
+                GdkPixbuf *pixbuf;
+
+                pixbuf = gtk_icon_theme_load_icon (gtk_icon_theme_get_default (),
+                                                   load->path,
+                                                   load->icon_size,
+                                                   GTK_ICON_LOOKUP_USE_BUILTIN,
+                                                   NULL);
+                if (pixbuf != NULL) {
+                        load->surface = surface_from_pixbuf (pixbuf);
+                        g_object_unref (pixbuf);
+                }
+                load->from_theme = load->surface != NULL;
+        }
+
+        /* themed icons are only added here, as the cache has to watch
+           the icon theme from the main thread */
+        if (load->from_theme) {
+                nd_image_cache_add (load->path,
+                                    load->size,
+                                    ND_IMAGE_SOURCE_THEME,
+                                    NULL,
+                                    load->surface);
+                load->from_theme = FALSE;
+        }
+
+        /* share the image with the other views, unless the
+           notification got updated in the meantime */
+        if (load->serial == notification->image_serial
+            && (! notification->image_loaded || notification->image_size != load->size)) {
+                if (notification->image != NULL) {
+                        cairo_surface_destroy (notification->image);
+                }
+
+                notification->image = load->surface != NULL ? cairo_surface_reference (load->surface) : NULL;
+                notification->image_size = load->size;
+                notification->image_loaded = TRUE;
+        }
+
+        if (g_cancellable_set_error_if_cancelled (load->cancellable, error)) {
+                return NULL;
+        }
+
+        if (load->surface == NULL) {
+                return NULL;
+        }
+
+        return cairo_surface_reference (load->surface);
 }
 
 void
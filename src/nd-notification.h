@@ -21,7 +21,9 @@
 #define __ND_NOTIFICATION__ 1
 
 #include <glib-object.h>
+#include <gio/gio.h>
 #include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
 
 G_BEGIN_DECLS
 
@@ -44,6 +46,30 @@ typedef enum
         ND_NOTIFICATION_CLOSED_RESERVED = 4
 } NdNotificationClosedReason;
 
+/* Fields of a notification that changed in an update, passed with
+ * the "changed" signal. */
+typedef enum
+{
+        ND_NOTIFICATION_CHANGED_APP_NAME   = 1 << 0,
+        ND_NOTIFICATION_CHANGED_SUMMARY    = 1 << 1,
+        ND_NOTIFICATION_CHANGED_BODY       = 1 << 2,
+        ND_NOTIFICATION_CHANGED_ICON       = 1 << 3,
+        ND_NOTIFICATION_CHANGED_ACTIONS    = 1 << 4,
+        ND_NOTIFICATION_CHANGED_IMAGE_DATA = 1 << 5,
+        ND_NOTIFICATION_CHANGED_IMAGE_PATH = 1 << 6,
+        ND_NOTIFICATION_CHANGED_ICON_DATA  = 1 << 7,
+        ND_NOTIFICATION_CHANGED_HINTS      = 1 << 8,
+        ND_NOTIFICATION_CHANGED_TIMEOUT    = 1 << 9,
+        ND_NOTIFICATION_CHANGED_VALUE      = 1 << 10
+} NdNotificationChange;
+
+/* everything the displayed image is made from */
+#define ND_NOTIFICATION_CHANGED_IMAGE (ND_NOTIFICATION_CHANGED_ICON       \
+                                       | ND_NOTIFICATION_CHANGED_IMAGE_DATA \
+                                       | ND_NOTIFICATION_CHANGED_IMAGE_PATH \
+                                       | ND_NOTIFICATION_CHANGED_ICON_DATA)
+#define ND_NOTIFICATION_CHANGED_ALL   ((1 << 11) - 1)
+
 GType                 nd_notification_get_type            (void) G_GNUC_CONST;
 
 NdNotification *      nd_notification_new                 (const char     *sender);
@@ -68,13 +94,32 @@ const char *          nd_notification_get_icon            (NdNotification *notif
 const char *          nd_notification_get_summary         (NdNotification *notification);
 const char *          nd_notification_get_body            (NdNotification *notification);
 char **               nd_notification_get_actions         (NdNotification *notification);
-GHashTable *          nd_notification_get_hints           (NdNotification *notification);
+GVariant *            nd_notification_get_hint            (NdNotification *notification,
+                                                           const char     *key);
 
-GdkPixbuf *           nd_notification_load_image          (NdNotification *notification,
-                                                           int             size);
+gboolean              nd_notification_has_image           (NdNotification *notification);
+gboolean              nd_notification_peek_image          (NdNotification *notification,
+                                                           int             size,
+                                                           cairo_surface_t **surface);
+void                  nd_notification_load_image_async    (NdNotification *notification,
+                                                           int             size,
+                                                           GCancellable   *cancellable,
+                                                           GAsyncReadyCallback callback,
+                                                           gpointer        user_data);
+cairo_surface_t *     nd_notification_load_image_finish   (NdNotification *notification,
+                                                           GAsyncResult   *result,
+                                                           GError        **error);
 gboolean              nd_notification_get_is_resident     (NdNotification *notification);
 gboolean              nd_notification_get_is_transient    (NdNotification *notification);
 gboolean              nd_notification_get_action_icons    (NdNotification *notification);
+int                   nd_notification_get_value           (NdNotification *notification);
+const char *          nd_notification_get_synchronous     (NdNotification *notification);
+guint8                nd_notification_get_urgency         (NdNotification *notification);
+const char *          nd_notification_get_category        (NdNotification *notification);
+const char *          nd_notification_get_desktop_entry   (NdNotification *notification);
+const char *          nd_notification_get_sound_file      (NdNotification *notification);
+const char *          nd_notification_get_sound_name      (NdNotification *notification);
+gboolean              nd_notification_get_suppress_sound  (NdNotification *notification);
 
 void                  nd_notification_close               (NdNotification *notification,
                                                            NdNotificationClosedReason reason);
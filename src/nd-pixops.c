@@ -0,0 +1,642 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "nd-pixops.h"
+
+/* cleared by the tests and the benchmark to compare with the scalar code */
+static gboolean simd_enabled = TRUE;
+
+void
+_nd_pixops_set_simd_enabled (gboolean enabled)
+{
+        simd_enabled = enabled;
+}
+
+/* Box filter: every destination pixel is the average of the block of
+ * source pixels it covers.  The source rows of a block are first summed
+ * up per column, which is the part that touches every source byte and
+ * is vectorized, then the columns of each block are added up and
+ * written as cairo pixels, see nd_pixops_scale_down().  RGBA pixels are
+ * weighted by their alpha, so transparent pixels do not bleed their
+ * color into the result.
+ *
+ * There is no AVX2 variant: SSE2 is the only extension every x86-64
+ * build can assume, so AVX2 would need runtime CPU dispatch, and most
+ * sources are already small, JPEG being decoded close to icon size. */
+
+static void
+accumulate_row_scalar (guint32      *acc,
+                       const guchar *row,
+                       int           n_bytes,
+                       gboolean      has_alpha)
+{
+        int i;
+
+        if (has_alpha) {
+                for (i = 0; i < n_bytes; i += 4) {
+                        guint32 a = row[i + 3];
+
+                        acc[i] += row[i] * a;
+                        acc[i + 1] += row[i + 1] * a;
+                        acc[i + 2] += row[i + 2] * a;
+                        acc[i + 3] += a;
+                }
+        } else {
+                for (i = 0; i < n_bytes; i++) {
+                        acc[i] += row[i];
+                }
+        }
+}
+
+#ifdef __SSE2__
+static inline void
+add_epi16_to_acc (guint32 *acc,
+                  __m128i  v)
+{
+        const __m128i zero = _mm_setzero_si128 ();
+        __m128i       lo;
+        __m128i       hi;
+
+        lo = _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *) acc),
+                            _mm_unpacklo_epi16 (v, zero));
+        hi = _mm_add_epi32 (_mm_loadu_si128 ((const __m128i *) (acc + 4)),
+                            _mm_unpackhi_epi16 (v, zero));
+        _mm_storeu_si128 ((__m128i *) acc, lo);
+        _mm_storeu_si128 ((__m128i *) (acc + 4), hi);
+}
+
+static inline __m128i
+premultiply_epi16 (__m128i v)
+{
+        /* alpha is the fourth 16 bit lane of each pixel */
+        const __m128i alpha_mask = _mm_set_epi16 (-1, 0, 0, 0, -1, 0, 0, 0);
+        __m128i       alpha;
+        __m128i       product;
+
+        alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, _MM_SHUFFLE (3, 3, 3, 3)),
+                                     _MM_SHUFFLE (3, 3, 3, 3));
+
+        /* 255 * 255 still fits in 16 bits */
+        product = _mm_mullo_epi16 (v, alpha);
+
+        return _mm_or_si128 (_mm_andnot_si128 (alpha_mask, product),
+                             _mm_and_si128 (alpha_mask, v));
+}
+
+static void
+accumulate_row (guint32      *acc,
+                const guchar *row,
+                int           n_bytes,
+                gboolean      has_alpha)
+{
+        const __m128i zero = _mm_setzero_si128 ();
+        int           i;
+
+        for (i = 0; simd_enabled && i + 16 <= n_bytes; i += 16) {
+                __m128i v;
+                __m128i lo;
+                __m128i hi;
+
+                v = _mm_loadu_si128 ((const __m128i *) (row + i));
+                lo = _mm_unpacklo_epi8 (v, zero);
+                hi = _mm_unpackhi_epi8 (v, zero);
+
+                if (has_alpha) {
+                        lo = premultiply_epi16 (lo);
+                        hi = premultiply_epi16 (hi);
+                }
+
+                add_epi16_to_acc (acc + i, lo);
+                add_epi16_to_acc (acc + i + 8, hi);
+        }
+
+        accumulate_row_scalar (acc + i, row + i, n_bytes - i, has_alpha);
+}
+#else
+#define accumulate_row accumulate_row_scalar
+#endif
+
+/* Conversion of the layouts allowed by image-data that gdk-pixbuf does
+ * not handle, 16 bits per sample and gray images, to 8 bit RGB(A). */
+
+static void
+convert_row_16_to_8 (guchar       *dest,
+                     const guchar *src,
+                     int           n_samples)
+{
+        int i;
+
+        /* round (v / 257) is (t - (t >> 8)) >> 8 with t = v + 128,
+           saturated to 16 bits */
+        i = 0;
+#ifdef __SSE2__
+        {
+                const __m128i bias = _mm_set1_epi16 (0x80);
+
+                for (; simd_enabled && i + 16 <= n_samples; i += 16) {
+                        __m128i a;
+                        __m128i b;
+
+                        a = _mm_loadu_si128 ((const __m128i *) (src + i * 2));
+                        b = _mm_loadu_si128 ((const __m128i *) (src + i * 2 + 16));
+
+                        a = _mm_adds_epu16 (a, bias);
+                        b = _mm_adds_epu16 (b, bias);
+                        a = _mm_srli_epi16 (_mm_sub_epi16 (a, _mm_srli_epi16 (a, 8)), 8);
+                        b = _mm_srli_epi16 (_mm_sub_epi16 (b, _mm_srli_epi16 (b, 8)), 8);
+
+                        _mm_storeu_si128 ((__m128i *) (dest + i), _mm_packus_epi16 (a, b));
+                }
+        }
+#endif
+        for (; i < n_samples; i++) {
+                guint16 v;
+                guint32 t;
+
+                memcpy (&v, src + i * 2, sizeof (v));
+                t = MIN ((guint32) v + 0x80, 0xffff);
+                dest[i] = (t - (t >> 8)) >> 8;
+        }
+}
+
+/* Returns a new 8 bit RGB or RGBA pixbuf with a copy of the image in
+ * data, which has 1 (gray), 2 (gray, alpha), 3 (RGB) or 4 (RGBA)
+ * samples of 8 or 16 bits in native byte order per pixel.  The caller
+ * has to make sure data holds height rows of rowstride bytes. */
+GdkPixbuf *
+nd_pixops_pixbuf_from_data (const guchar *data,
+                            int           width,
+                            int           height,
+                            int           rowstride,
+                            int           n_channels,
+                            int           bits_per_sample)
+{
+        GdkPixbuf *pixbuf;
+        guchar    *pixels;
+        guchar    *tmp;
+        int        dest_rowstride;
+        int        n_samples;
+        int        x;
+        int        y;
+
+        g_return_val_if_fail (data != NULL, NULL);
+        g_return_val_if_fail (n_channels >= 1 && n_channels <= 4, NULL);
+        g_return_val_if_fail (bits_per_sample == 8 || bits_per_sample == 16, NULL);
+
+        pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB,
+                                 n_channels == 2 || n_channels == 4,
+                                 8,
+                                 width,
+                                 height);
+        if (pixbuf == NULL) {
+                return NULL;
+        }
+
+        pixels = gdk_pixbuf_get_pixels (pixbuf);
+        dest_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+        n_samples = width * n_channels;
+
+        /* gray rows are brought to 8 bits before being expanded */
+        tmp = n_channels < 3 ? g_new (guchar, n_samples) : NULL;
+
+        for (y = 0; y < height; y++) {
+                const guchar *src = data + (gsize) y * rowstride;
+                guchar       *dest = pixels + (gsize) y * dest_rowstride;
+                guchar       *row;
+
+                row = tmp != NULL ? tmp : dest;
+
+                if (bits_per_sample == 16) {
+                        convert_row_16_to_8 (row, src, n_samples);
+                } else {
+                        memcpy (row, src, n_samples);
+                }
+
+                if (n_channels == 1) {
+                        for (x = 0; x < width; x++) {
+                                dest[x * 3] = dest[x * 3 + 1] = dest[x * 3 + 2] = row[x];
+                        }
+                } else if (n_channels == 2) {
+                        for (x = 0; x < width; x++) {
+                                dest[x * 4] = dest[x * 4 + 1] = dest[x * 4 + 2] = row[x * 2];
+                                dest[x * 4 + 3] = row[x * 2 + 1];
+                        }
+                }
+        }
+
+        g_free (tmp);
+
+        return pixbuf;
+}
+
+/* Conversion to the premultiplied, native endian ARGB32 layout of
+ * cairo, done once when the image is loaded instead of every time it
+ * is painted.  Opaque images are stored as RGB24, which only needs the
+ * channels to be reordered. */
+
+#define MUL_UN8(a, b, t) ((t) = (a) * (b) + 0x80, (((t) >> 8) + (t)) >> 8)
+
+#if defined (__SSE2__) && G_BYTE_ORDER == G_LITTLE_ENDIAN
+#define HAVE_SSE2_CONVERSION 1
+#endif
+
+static gboolean
+row_is_opaque (const guchar *row,
+               int           width)
+{
+        int i;
+
+        i = 0;
+#ifdef HAVE_SSE2_CONVERSION
+        {
+                const __m128i color_mask = _mm_set1_epi32 (0x00ffffff);
+                const __m128i ones = _mm_set1_epi32 (-1);
+
+                for (; simd_enabled && i + 4 <= width; i += 4) {
+                        __m128i v;
+
+                        v = _mm_or_si128 (_mm_loadu_si128 ((const __m128i *) (row + i * 4)),
+                                          color_mask);
+                        if (_mm_movemask_epi8 (_mm_cmpeq_epi8 (v, ones)) != 0xffff) {
+                                return FALSE;
+                        }
+                }
+        }
+#endif
+        for (; i < width; i++) {
+                if (row[i * 4 + 3] != 0xff) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+static gboolean
+pixbuf_is_opaque (GdkPixbuf *pixbuf)
+{
+        const guchar *pixels;
+        int           rowstride;
+        int           width;
+        int           height;
+        int           y;
+
+        if (! gdk_pixbuf_get_has_alpha (pixbuf)) {
+                return TRUE;
+        }
+
+        pixels = gdk_pixbuf_get_pixels (pixbuf);
+        rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+        width = gdk_pixbuf_get_width (pixbuf);
+        height = gdk_pixbuf_get_height (pixbuf);
+
+        for (y = 0; y < height; y++) {
+                if (! row_is_opaque (pixels + (gsize) y * rowstride, width)) {
+                        return FALSE;
+                }
+        }
+
+        return TRUE;
+}
+
+#ifdef HAVE_SSE2_CONVERSION
+static inline __m128i
+premultiply_swizzle_epi16 (__m128i v)
+{
+        const __m128i alpha_mask = _mm_set_epi16 (-1, 0, 0, 0, -1, 0, 0, 0);
+        const __m128i bias = _mm_set1_epi16 (0x80);
+        __m128i       alpha;
+        __m128i       t;
+
+        /* RGBA -> BGRA, the memory order of ARGB32 on little endian */
+        v = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, _MM_SHUFFLE (3, 0, 1, 2)),
+                                 _MM_SHUFFLE (3, 0, 1, 2));
+        alpha = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, _MM_SHUFFLE (3, 3, 3, 3)),
+                                     _MM_SHUFFLE (3, 3, 3, 3));
+
+        /* c * a / 255, rounded, like MUL_UN8() */
+        t = _mm_add_epi16 (_mm_mullo_epi16 (v, alpha), bias);
+        t = _mm_srli_epi16 (_mm_add_epi16 (t, _mm_srli_epi16 (t, 8)), 8);
+
+        return _mm_or_si128 (_mm_andnot_si128 (alpha_mask, t),
+                             _mm_and_si128 (alpha_mask, v));
+}
+
+static inline __m128i
+swizzle_epi16 (__m128i v)
+{
+        return _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (v, _MM_SHUFFLE (3, 0, 1, 2)),
+                                    _MM_SHUFFLE (3, 0, 1, 2));
+}
+#endif
+
+static void
+convert_row_rgba (guint32      *dest,
+                  const guchar *src,
+                  int           width,
+                  gboolean      opaque)
+{
+        int i;
+
+        i = 0;
+#ifdef HAVE_SSE2_CONVERSION
+        {
+                const __m128i zero = _mm_setzero_si128 ();
+                const __m128i alpha = _mm_set1_epi32 (0xff000000);
+
+                for (; simd_enabled && i + 4 <= width; i += 4) {
+                        __m128i v;
+                        __m128i lo;
+                        __m128i hi;
+
+                        v = _mm_loadu_si128 ((const __m128i *) (src + i * 4));
+                        lo = _mm_unpacklo_epi8 (v, zero);
+                        hi = _mm_unpackhi_epi8 (v, zero);
+
+                        if (opaque) {
+                                lo = swizzle_epi16 (lo);
+                                hi = swizzle_epi16 (hi);
+                                v = _mm_or_si128 (_mm_packus_epi16 (lo, hi), alpha);
+                        } else {
+                                lo = premultiply_swizzle_epi16 (lo);
+                                hi = premultiply_swizzle_epi16 (hi);
+                                v = _mm_packus_epi16 (lo, hi);
+                        }
+
+                        _mm_storeu_si128 ((__m128i *) (dest + i), v);
+                }
+        }
+#endif
+        for (; i < width; i++) {
+                const guchar *p = src + i * 4;
+                guint32       a;
+                guint32       r;
+                guint32       g;
+                guint32       b;
+                guint32       t;
+
+                if (opaque) {
+                        dest[i] = 0xff000000 | (p[0] << 16) | (p[1] << 8) | p[2];
+                        continue;
+                }
+
+                a = p[3];
+                r = MUL_UN8 (p[0], a, t);
+                g = MUL_UN8 (p[1], a, t);
+                b = MUL_UN8 (p[2], a, t);
+                dest[i] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+}
+
+static void
+convert_row_rgb (guint32      *dest,
+                 const guchar *src,
+                 int           width)
+{
+        int i;
+
+        for (i = 0; i < width; i++) {
+                const guchar *p = src + i * 3;
+
+                dest[i] = 0xff000000 | (p[0] << 16) | (p[1] << 8) | p[2];
+        }
+}
+
+/* Returns a new image surface with the pixels of pixbuf, ready to be
+ * painted with cairo.  May be called from any thread. */
+cairo_surface_t *
+nd_pixops_surface_from_pixbuf (GdkPixbuf *pixbuf)
+{
+        cairo_surface_t *surface;
+        const guchar    *src_pixels;
+        guchar          *dest_pixels;
+        int              src_rowstride;
+        int              dest_rowstride;
+        int              width;
+        int              height;
+        int              n_channels;
+        gboolean         opaque;
+        int              y;
+
+        g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+        g_return_val_if_fail (gdk_pixbuf_get_bits_per_sample (pixbuf) == 8, NULL);
+
+        width = gdk_pixbuf_get_width (pixbuf);
+        height = gdk_pixbuf_get_height (pixbuf);
+        n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+        opaque = pixbuf_is_opaque (pixbuf);
+
+        surface = cairo_image_surface_create (opaque ? CAIRO_FORMAT_RGB24 : CAIRO_FORMAT_ARGB32,
+                                              width,
+                                              height);
+        if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+                return surface;
+        }
+
+        src_pixels = gdk_pixbuf_get_pixels (pixbuf);
+        src_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+        dest_pixels = cairo_image_surface_get_data (surface);
+        dest_rowstride = cairo_image_surface_get_stride (surface);
+
+        for (y = 0; y < height; y++) {
+                const guchar *src = src_pixels + (gsize) y * src_rowstride;
+                guint32      *dest = (guint32 *) (dest_pixels + (gsize) y * dest_rowstride);
+
+                if (n_channels == 4) {
+                        convert_row_rgba (dest, src, width, opaque);
+                } else {
+                        convert_row_rgb (dest, src, width);
+                }
+        }
+
+        cairo_surface_mark_dirty (surface);
+
+        return surface;
+}
+
+/* Averages the columns of each block and writes the result as native
+ * endian ARGB32, premultiplied for weighted (translucent) sources: the
+ * alpha weighted sum of a color divided by 255 times the pixel count is
+ * the average color already multiplied by the average alpha. */
+static void
+reduce_row (const guint32 *acc,
+            guint32       *dest,
+            int            src_width,
+            int            dest_width,
+            int            n_channels,
+            guint          n_rows,
+            gboolean       weighted)
+{
+        int x;
+
+        for (x = 0; x < dest_width; x++) {
+                int     x0;
+                int     x1;
+                int     sx;
+                int     c;
+                guint64 sum[4] = { 0, 0, 0, 0 };
+                guint64 count;
+                guint64 div;
+                guint32 pixel[4];
+
+                x0 = (gint64) x * src_width / dest_width;
+                x1 = (gint64) (x + 1) * src_width / dest_width;
+
+                for (sx = x0; sx < x1; sx++) {
+                        for (c = 0; c < n_channels; c++) {
+                                sum[c] += acc[sx * n_channels + c];
+                        }
+                }
+
+                count = (guint64) (x1 - x0) * n_rows;
+
+                if (! weighted) {
+                        pixel[3] = 0xff;
+                        div = count;
+                } else if (sum[3] == 0) {
+                        dest[x] = 0;
+                        continue;
+                } else {
+                        pixel[3] = (sum[3] + count / 2) / count;
+                        div = count * 255;
+                }
+
+                for (c = 0; c < 3; c++) {
+                        pixel[c] = (sum[c] + div / 2) / div;
+                }
+
+                dest[x] = (pixel[3] << 24) | (pixel[0] << 16) | (pixel[1] << 8) | pixel[2];
+        }
+}
+
+/* Returns a new image surface with pixbuf shrunk to dest_width x
+ * dest_height by averaging, which is both faster and free of the
+ * aliasing of the bilinear filter for large reductions.  The averages
+ * go straight into the surface, without an intermediate pixbuf.  Falls
+ * back to gdk-pixbuf for formats it does not handle or when asked to
+ * enlarge.  May be called from any thread. */
+cairo_surface_t *
+nd_pixops_scale_down (GdkPixbuf *pixbuf,
+                      int        dest_width,
+                      int        dest_height)
+{
+        cairo_surface_t *surface;
+        const guchar    *src_pixels;
+        guchar          *dest_pixels;
+        guint32         *acc;
+        int              src_width;
+        int              src_height;
+        int              src_rowstride;
+        int              dest_rowstride;
+        int              n_channels;
+        gboolean         has_alpha;
+        gboolean         weighted;
+        int              y;
+
+        g_return_val_if_fail (GDK_IS_PIXBUF (pixbuf), NULL);
+        g_return_val_if_fail (dest_width > 0 && dest_height > 0, NULL);
+
+        src_width = gdk_pixbuf_get_width (pixbuf);
+        src_height = gdk_pixbuf_get_height (pixbuf);
+        n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+        has_alpha = gdk_pixbuf_get_has_alpha (pixbuf);
+
+        if (dest_width > src_width
+            || dest_height > src_height
+            || gdk_pixbuf_get_colorspace (pixbuf) != GDK_COLORSPACE_RGB
+            || gdk_pixbuf_get_bits_per_sample (pixbuf) != 8
+            || n_channels != (has_alpha ? 4 : 3)
+            || (src_height + dest_height - 1) / dest_height > G_MAXUINT32 / (255 * 255)) {
+                GdkPixbuf *scaled;
+
+                scaled = gdk_pixbuf_scale_simple (pixbuf,
+                                                  dest_width,
+                                                  dest_height,
+                                                  GDK_INTERP_BILINEAR);
+                if (scaled == NULL) {
+                        return NULL;
+                }
+                surface = nd_pixops_surface_from_pixbuf (scaled);
+                g_object_unref (scaled);
+
+                return surface;
+        }
+
+        /* averages of opaque pixels are opaque, and need no weighting */
+        weighted = ! pixbuf_is_opaque (pixbuf);
+
+        surface = cairo_image_surface_create (weighted ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24,
+                                              dest_width,
+                                              dest_height);
+        if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS) {
+                return surface;
+        }
+
+        src_pixels = gdk_pixbuf_get_pixels (pixbuf);
+        src_rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+        dest_pixels = cairo_image_surface_get_data (surface);
+        dest_rowstride = cairo_image_surface_get_stride (surface);
+
+        acc = g_new (guint32, src_width * n_channels);
+
+        for (y = 0; y < dest_height; y++) {
+                int y0;
+                int y1;
+                int sy;
+
+                y0 = (gint64) y * src_height / dest_height;
+                y1 = (gint64) (y + 1) * src_height / dest_height;
+
+                memset (acc, 0, src_width * n_channels * sizeof (guint32));
+
+                for (sy = y0; sy < y1; sy++) {
+                        accumulate_row (acc,
+                                        src_pixels + (gsize) sy * src_rowstride,
+                                        src_width * n_channels,
+                                        weighted);
+                }
+
+                reduce_row (acc,
+                            (guint32 *) (dest_pixels + (gsize) y * dest_rowstride),
+                            src_width,
+                            dest_width,
+                            n_channels,
+                            y1 - y0,
+                            weighted);
+        }
+
+        g_free (acc);
+
+        cairo_surface_mark_dirty (surface);
+
+        return surface;
+}
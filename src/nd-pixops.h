@@ -0,0 +1,46 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_PIXOPS_H
+#define __ND_PIXOPS_H
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
+
+G_BEGIN_DECLS
+
+cairo_surface_t *   nd_pixops_scale_down                    (GdkPixbuf     *pixbuf,
+                                                             int            dest_width,
+                                                             int            dest_height);
+GdkPixbuf *         nd_pixops_pixbuf_from_data              (const guchar  *data,
+                                                             int            width,
+                                                             int            height,
+                                                             int            rowstride,
+                                                             int            n_channels,
+                                                             int            bits_per_sample);
+cairo_surface_t *   nd_pixops_surface_from_pixbuf           (GdkPixbuf     *pixbuf);
+
+/* for test-pixops and bench-pixops */
+void                _nd_pixops_set_simd_enabled             (gboolean       enabled);
+
+G_END_DECLS
+
+#endif /* __ND_PIXOPS_H */
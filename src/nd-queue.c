@@ -39,11 +39,21 @@
 
 #define WIDTH         400
 
+/* hidden bubbles kept around per screen for the next notifications */
+#define MAX_POOLED_BUBBLES 2
+
+/* size the status icon is loaded at while prewarming */
+#define PREWARM_ICON_SIZE 24
+
+/* the key a synchronous notification is indexed under */
+#define SYNCHRONOUS_KEY "nd-queue-synchronous-key"
+
 typedef struct
 {
         NdStack   **stacks;
         int         n_stacks;
         Atom        workarea_atom;
+        GSList     *bubble_pool;
 } NotifyScreen;
 
 struct NdQueuePrivate
@@ -52,6 +62,12 @@ struct NdQueuePrivate
         GHashTable    *bubbles;
         GQueue        *queue;
 
+        /* "sender\ntag" -> synchronous notification */
+        GHashTable    *synchronous;
+        /* id -> bubble of the notifications shown, NULL for the
+           ones still queued */
+        GHashTable    *displayed;
+
         GtkStatusIcon *status_icon;
         GIcon         *numerable_icon;
         GtkWidget     *dock;
@@ -61,6 +77,17 @@ struct NdQueuePrivate
         int            n_screens;
 
         guint          update_id;
+
+        guint          prewarm_id;
+        gboolean       prewarmed;
+        gint64         prewarm_time;
+
+        /* first paint latency, -1 until measured */
+        NdBubble      *paint_bubble;
+        gint64         paint_start;
+        gboolean       paint_warm;
+        gint64         cold_first_paint;
+        gint64         warm_first_paint;
 };
 
 enum {
@@ -77,6 +104,11 @@ static void     queue_update            (NdQueue        *queue);
 static void     on_notification_close   (NdNotification *notification,
                                          int             reason,
                                          NdQueue        *queue);
+static void     on_notification_changed (NdNotification *notification,
+                                         guint           changes,
+                                         NdQueue        *queue);
+static void     forget_notification     (NdQueue        *queue,
+                                         NdNotification *notification);
 
 static gpointer queue_object = NULL;
 
@@ -138,9 +170,12 @@ on_screen_monitors_changed (GdkScreen *screen,
                         bubbles = g_list_copy (nd_stack_get_bubbles (stack));
                         for (l = bubbles; l != NULL; l = l->next) {
                                 /* skip removing the bubble from the
-                                   old stack since it will try to
-                                   unrealize the window.  And the
-                                   stack is going away anyhow. */
+                                   old stack since it is going away
+                                   anyhow, just stop it from following
+                                   the bubble. */
+                                g_signal_handlers_disconnect_by_func (l->data,
+                                                                      G_CALLBACK (nd_stack_remove_bubble),
+                                                                      stack);
                                 nd_stack_add_bubble (last_stack, l->data, TRUE);
                         }
                         g_list_free (bubbles);
@@ -372,11 +407,12 @@ _nd_queue_remove_all (NdQueue *queue)
         clear_stacks (queue);
 
         g_queue_clear (queue->priv->queue);
+        g_hash_table_remove_all (queue->priv->displayed);
         g_hash_table_iter_init (&iter, queue->priv->notifications);
         while (g_hash_table_iter_next (&iter, &key, &value)) {
                 NdNotification *n = ND_NOTIFICATION (value);
 
-                g_signal_handlers_disconnect_by_func (n, G_CALLBACK (on_notification_close), queue);
+                forget_notification (queue, n);
                 nd_notification_close (n, ND_NOTIFICATION_CLOSED_USER);
                 g_hash_table_iter_remove (&iter);
                 changed = TRUE;
@@ -481,7 +517,11 @@ nd_queue_init (NdQueue *queue)
         queue->priv->notifications = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
         queue->priv->bubbles = g_hash_table_new_full (NULL, NULL, NULL, g_object_unref);
         queue->priv->queue = g_queue_new ();
+        queue->priv->synchronous = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+        queue->priv->displayed = g_hash_table_new (NULL, NULL);
         queue->priv->status_icon = NULL;
+        queue->priv->cold_first_paint = -1;
+        queue->priv->warm_first_paint = -1;
 
         create_dock (queue);
         create_screens (queue);
@@ -513,6 +553,11 @@ destroy_screens (NdQueue *queue)
                 }
 
                 g_free (queue->priv->screens[i]->stacks);
+
+                g_slist_foreach (queue->priv->screens[i]->bubble_pool,
+                                 (GFunc) gtk_widget_destroy,
+                                 NULL);
+                g_slist_free (queue->priv->screens[i]->bubble_pool);
         }
 
         g_free (queue->priv->screens);
@@ -532,7 +577,13 @@ nd_queue_finalize (GObject *object)
 
         g_return_if_fail (queue->priv != NULL);
 
+        if (queue->priv->prewarm_id != 0) {
+                g_source_remove (queue->priv->prewarm_id);
+        }
+
         g_hash_table_destroy (queue->priv->notifications);
+        g_hash_table_destroy (queue->priv->synchronous);
+        g_hash_table_destroy (queue->priv->displayed);
         g_queue_free (queue->priv->queue);
 
         destroy_screens (queue);
@@ -557,6 +608,63 @@ nd_queue_lookup (NdQueue *queue,
         return notification;
 }
 
+static char *
+get_synchronous_key (const char *sender,
+                     const char *tag)
+{
+        return g_strdup_printf ("%s\n%s", sender, tag);
+}
+
+static void
+unindex_synchronous (NdQueue        *queue,
+                     NdNotification *notification)
+{
+        const char *key;
+
+        key = g_object_get_data (G_OBJECT (notification), SYNCHRONOUS_KEY);
+        if (key != NULL
+            && g_hash_table_lookup (queue->priv->synchronous, key) == notification) {
+                g_hash_table_remove (queue->priv->synchronous, key);
+        }
+        g_object_set_data (G_OBJECT (notification), SYNCHRONOUS_KEY, NULL);
+}
+
+static void
+index_synchronous (NdQueue        *queue,
+                   NdNotification *notification)
+{
+        const char *tag;
+        char       *key;
+
+        unindex_synchronous (queue, notification);
+
+        tag = nd_notification_get_synchronous (notification);
+        if (tag == NULL) {
+                return;
+        }
+
+        key = get_synchronous_key (nd_notification_get_sender (notification), tag);
+        g_hash_table_insert (queue->priv->synchronous, g_strdup (key), notification);
+        g_object_set_data_full (G_OBJECT (notification), SYNCHRONOUS_KEY, key, g_free);
+}
+
+NdNotification *
+nd_queue_lookup_synchronous (NdQueue    *queue,
+                             const char *sender,
+                             const char *tag)
+{
+        NdNotification *notification;
+        char           *key;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        key = get_synchronous_key (sender, tag);
+        notification = g_hash_table_lookup (queue->priv->synchronous, key);
+        g_free (key);
+
+        return notification;
+}
+
 guint
 nd_queue_length (NdQueue *queue)
 {
@@ -566,7 +674,8 @@ nd_queue_length (NdQueue *queue)
 }
 
 static NdStack *
-get_stack_with_pointer (NdQueue *queue)
+get_stack_with_pointer (NdQueue    *queue,
+                        GdkScreen **screen_out)
 {
         GdkScreen *screen;
         int        x, y;
@@ -587,25 +696,102 @@ get_stack_with_pointer (NdQueue *queue)
                 monitor_num = queue->priv->screens[screen_num]->n_stacks - 1;
         }
 
+        if (screen_out != NULL) {
+                *screen_out = screen;
+        }
+
         return queue->priv->screens[screen_num]->stacks[monitor_num];
 }
 
+static gboolean
+on_bubble_first_draw (GtkWidget *widget,
+                      cairo_t   *cr,
+                      NdQueue   *queue)
+{
+        gint64 elapsed;
+
+        elapsed = g_get_monotonic_time () - queue->priv->paint_start;
+        if (queue->priv->paint_warm) {
+                queue->priv->warm_first_paint = elapsed;
+        } else {
+                queue->priv->cold_first_paint = elapsed;
+        }
+        g_debug ("First %s paint after %" G_GINT64_FORMAT " us",
+                 queue->priv->paint_warm ? "warm" : "cold",
+                 elapsed);
+
+        g_signal_handlers_disconnect_by_func (widget,
+                                              G_CALLBACK (on_bubble_first_draw),
+                                              queue);
+        queue->priv->paint_bubble = NULL;
+
+        return FALSE;
+}
+
 static void
-on_bubble_destroyed (NdBubble *bubble,
+on_bubble_dismissed (NdBubble *bubble,
                      NdQueue  *queue)
 {
         NdNotification *notification;
+        NotifyScreen   *nscreen;
+
+        g_debug ("Bubble dismissed");
+
+        if (bubble == queue->priv->paint_bubble) {
+                g_signal_handlers_disconnect_by_func (bubble,
+                                                      G_CALLBACK (on_bubble_first_draw),
+                                                      queue);
+                queue->priv->paint_bubble = NULL;
+        }
 
-        g_debug ("Bubble destroyed");
         notification = nd_bubble_get_notification (bubble);
+        g_hash_table_remove (queue->priv->displayed,
+                             GUINT_TO_POINTER (nd_notification_get_id (notification)));
         if (nd_notification_get_is_transient (notification)) {
                 g_debug ("Bubble is transient");
                 nd_notification_close (notification, ND_NOTIFICATION_CLOSED_EXPIRED);
         }
 
+        nd_bubble_set_notification (bubble, NULL);
+
+        nscreen = queue->priv->screens[gdk_screen_get_number (gtk_window_get_screen (GTK_WINDOW (bubble)))];
+        if (g_slist_length (nscreen->bubble_pool) < MAX_POOLED_BUBBLES) {
+                g_debug ("Keeping bubble for reuse");
+                nscreen->bubble_pool = g_slist_prepend (nscreen->bubble_pool, bubble);
+        } else {
+                g_signal_handlers_disconnect_by_func (bubble,
+                                                      G_CALLBACK (on_bubble_dismissed),
+                                                      queue);
+                gtk_widget_destroy (GTK_WIDGET (bubble));
+        }
+
         queue_update (queue);
 }
 
+/* Takes a hidden bubble from the pool of the screen, the window of a
+ * recycled bubble is already realized and styled, or makes a new one. */
+static NdBubble *
+get_bubble (NdQueue   *queue,
+            GdkScreen *screen)
+{
+        NotifyScreen *nscreen;
+        NdBubble     *bubble;
+
+        nscreen = queue->priv->screens[gdk_screen_get_number (screen)];
+        if (nscreen->bubble_pool != NULL) {
+                bubble = nscreen->bubble_pool->data;
+                nscreen->bubble_pool = g_slist_delete_link (nscreen->bubble_pool,
+                                                            nscreen->bubble_pool);
+                return bubble;
+        }
+
+        bubble = nd_bubble_new ();
+        gtk_window_set_screen (GTK_WINDOW (bubble), screen);
+        g_signal_connect_after (bubble, "dismissed", G_CALLBACK (on_bubble_dismissed), queue);
+
+        return bubble;
+}
+
 static void
 maybe_show_notification (NdQueue *queue)
 {
@@ -613,7 +799,9 @@ maybe_show_notification (NdQueue *queue)
         NdNotification *notification;
         NdBubble       *bubble;
         NdStack        *stack;
+        GdkScreen      *screen;
         GList          *list;
+        gint64          start;
 
         /* FIXME: show one at a time if not busy or away */
 
@@ -623,7 +811,7 @@ maybe_show_notification (NdQueue *queue)
                 return;
         }
 
-        stack = get_stack_with_pointer (queue);
+        stack = get_stack_with_pointer (queue, &screen);
         list = nd_stack_get_bubbles (stack);
         if (g_list_length (list) > 0) {
                 /* already showing bubbles */
@@ -641,8 +829,23 @@ maybe_show_notification (NdQueue *queue)
         notification = g_hash_table_lookup (queue->priv->notifications, id);
         g_assert (notification != NULL);
 
-        bubble = nd_bubble_new_for_notification (notification);
-        g_signal_connect (bubble, "destroy", G_CALLBACK (on_bubble_destroyed), queue);
+        start = g_get_monotonic_time ();
+
+        bubble = get_bubble (queue, screen);
+        nd_bubble_set_notification (bubble, notification);
+        g_hash_table_insert (queue->priv->displayed, id, bubble);
+
+        /* time the first bubble shown, which is either cold or warm:
+           once prewarmed no bubble is cold any more, even a new one,
+           so the cold time is only known when running with
+           --no-prewarm */
+        if (queue->priv->paint_bubble == NULL
+            && (queue->priv->prewarmed ? queue->priv->warm_first_paint : queue->priv->cold_first_paint) < 0) {
+                queue->priv->paint_bubble = bubble;
+                queue->priv->paint_start = start;
+                queue->priv->paint_warm = queue->priv->prewarmed;
+                g_signal_connect_after (bubble, "draw", G_CALLBACK (on_bubble_first_draw), queue);
+        }
 
         nd_stack_add_bubble (stack, bubble, TRUE);
 }
@@ -829,6 +1032,7 @@ show_dock (NdQueue *queue)
            full list now */
         clear_stacks (queue);
         g_queue_clear (queue->priv->queue);
+        g_hash_table_remove_all (queue->priv->displayed);
 
         popup_dock (queue, GDK_CURRENT_TIME);
 }
@@ -864,6 +1068,21 @@ on_status_icon_visible_notify (GtkStatusIcon *icon,
         }
 }
 
+static void
+ensure_numerable_icon (NdQueue *queue)
+{
+        GIcon *icon;
+
+        if (queue->priv->numerable_icon != NULL) {
+                return;
+        }
+
+        /* FIXME: use a more appropriate icon here */
+        icon = g_themed_icon_new ("mail-message-new");
+        queue->priv->numerable_icon = gtk_numerable_icon_new (icon);
+        g_object_unref (icon);
+}
+
 static gboolean
 update_idle (NdQueue *queue)
 {
@@ -895,13 +1114,7 @@ update_idle (NdQueue *queue)
                                           queue);
                 }
 
-                if (queue->priv->numerable_icon == NULL) {
-                        GIcon *icon;
-                        /* FIXME: use a more appropriate icon here */
-                        icon = g_themed_icon_new ("mail-message-new");
-                        queue->priv->numerable_icon = gtk_numerable_icon_new (icon);
-                        g_object_unref (icon);
-                }
+                ensure_numerable_icon (queue);
                 gtk_numerable_icon_set_count (GTK_NUMERABLE_ICON (queue->priv->numerable_icon), num);
                 gtk_status_icon_set_from_gicon (queue->priv->status_icon,
                                                 queue->priv->numerable_icon);
@@ -932,6 +1145,19 @@ queue_update (NdQueue *queue)
         queue->priv->update_id = g_idle_add ((GSourceFunc)update_idle, queue);
 }
 
+/* Undoes what _nd_queue_add() set up, except for the notifications
+ * table and the display queue. */
+static void
+forget_notification (NdQueue        *queue,
+                     NdNotification *notification)
+{
+        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_notification_close), queue);
+        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_notification_changed), queue);
+        unindex_synchronous (queue, notification);
+        g_hash_table_remove (queue->priv->displayed,
+                             GUINT_TO_POINTER (nd_notification_get_id (notification)));
+}
+
 static void
 _nd_queue_remove (NdQueue        *queue,
                   NdNotification *notification)
@@ -943,7 +1169,7 @@ _nd_queue_remove (NdQueue        *queue,
 
         /* FIXME: withdraw currently showing bubbles */
 
-        g_signal_handlers_disconnect_by_func (notification, G_CALLBACK (on_notification_close), queue);
+        forget_notification (queue, notification);
 
         if (queue->priv->queue != NULL) {
                 g_queue_remove (queue->priv->queue, GUINT_TO_POINTER (id));
@@ -965,6 +1191,17 @@ on_notification_close (NdNotification *notification,
         _nd_queue_remove (queue, notification);
 }
 
+static void
+on_notification_changed (NdNotification *notification,
+                         guint           changes,
+                         NdQueue        *queue)
+{
+        /* the synchronous tag is a hint */
+        if (changes & ND_NOTIFICATION_CHANGED_HINTS) {
+                index_synchronous (queue, notification);
+        }
+}
+
 void
 nd_queue_remove_for_id (NdQueue *queue,
                         guint    id)
@@ -979,22 +1216,153 @@ nd_queue_remove_for_id (NdQueue *queue,
         }
 }
 
+static void
+_nd_queue_add (NdQueue        *queue,
+               NdNotification *notification)
+{
+        guint id;
+
+        id = nd_notification_get_id (notification);
+        g_debug ("Adding id %u", id);
+        g_hash_table_insert (queue->priv->notifications, GUINT_TO_POINTER (id), g_object_ref (notification));
+        g_queue_push_head (queue->priv->queue, GUINT_TO_POINTER (id));
+        g_hash_table_insert (queue->priv->displayed, GUINT_TO_POINTER (id), NULL);
+        index_synchronous (queue, notification);
+
+        g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), queue);
+        g_signal_connect (notification, "changed", G_CALLBACK (on_notification_changed), queue);
+}
+
+/* Drops the notifications of a client that went away, in one go.
+ * Resident notifications are kept until the user dismisses them. */
+void
+nd_queue_remove_for_sender (NdQueue    *queue,
+                            const char *sender)
+{
+        GHashTableIter iter;
+        gpointer       value;
+        GList         *bubbles;
+        GList         *dropped;
+        GList         *l;
+
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        /* Take the bubbles of the sender off the screen first.  Their
+           "dismissed" handler closes the transient notifications,
+           which leaves them out of the loop below. */
+        bubbles = NULL;
+        g_hash_table_iter_init (&iter, queue->priv->displayed);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                NdNotification *n;
+
+                if (value == NULL) {
+                        continue;
+                }
+
+                n = nd_bubble_get_notification (ND_BUBBLE (value));
+                if (g_strcmp0 (nd_notification_get_sender (n), sender) == 0
+                    && ! nd_notification_get_is_resident (n)) {
+                        bubbles = g_list_prepend (bubbles, g_object_ref (value));
+                }
+        }
+
+        for (l = bubbles; l != NULL; l = l->next) {
+                nd_bubble_dismiss (ND_BUBBLE (l->data));
+                g_object_unref (l->data);
+        }
+        g_list_free (bubbles);
+
+        dropped = NULL;
+
+        g_hash_table_iter_init (&iter, queue->priv->notifications);
+        while (g_hash_table_iter_next (&iter, NULL, &value)) {
+                NdNotification *n = ND_NOTIFICATION (value);
+
+                if (g_strcmp0 (nd_notification_get_sender (n), sender) != 0
+                    || nd_notification_get_is_resident (n)) {
+                        continue;
+                }
+
+                forget_notification (queue, n);
+                g_queue_remove (queue->priv->queue, GUINT_TO_POINTER (nd_notification_get_id (n)));
+
+                dropped = g_list_prepend (dropped, g_object_ref (n));
+                g_hash_table_iter_remove (&iter);
+        }
+
+        if (dropped == NULL) {
+                return;
+        }
+
+        g_debug ("Dropped %u notifications of %s", g_list_length (dropped), sender);
+
+        for (l = dropped; l != NULL; l = l->next) {
+                nd_notification_close (ND_NOTIFICATION (l->data), ND_NOTIFICATION_CLOSED_EXPIRED);
+                g_object_unref (l->data);
+        }
+        g_list_free (dropped);
+
+        g_signal_emit (queue, signals[CHANGED], 0);
+
+        queue_update (queue);
+}
+
 void
 nd_queue_add (NdQueue        *queue,
               NdNotification *notification)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        _nd_queue_add (queue, notification);
+
+        /* FIXME: should probably only emit this when it really adds something */
+        g_signal_emit (queue, signals[CHANGED], 0);
+
+        queue_update (queue);
+}
+
+/* Queues a notification that is kept around, but neither queued nor
+ * shown any more, to be shown again, like a synchronous notification
+ * whose bubble timed out before it was replaced. */
+void
+nd_queue_show_again (NdQueue        *queue,
+                     NdNotification *notification)
 {
         guint id;
 
         g_return_if_fail (ND_IS_QUEUE (queue));
 
         id = nd_notification_get_id (notification);
-        g_debug ("Adding id %u", id);
-        g_hash_table_insert (queue->priv->notifications, GUINT_TO_POINTER (id), g_object_ref (notification));
+        g_return_if_fail (g_hash_table_lookup (queue->priv->notifications, GUINT_TO_POINTER (id)) == notification);
+
+        if (g_hash_table_lookup_extended (queue->priv->displayed, GUINT_TO_POINTER (id), NULL, NULL)) {
+                return;
+        }
+
+        g_debug ("Showing id %u again", id);
         g_queue_push_head (queue->priv->queue, GUINT_TO_POINTER (id));
+        g_hash_table_insert (queue->priv->displayed, GUINT_TO_POINTER (id), NULL);
 
-        g_signal_connect (notification, "closed", G_CALLBACK (on_notification_close), queue);
+        queue_update (queue);
+}
 
-        /* FIXME: should probably only emit this when it really adds something */
+void
+nd_queue_add_list (NdQueue *queue,
+                   GList   *notifications)
+{
+        GList *l;
+
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        if (notifications == NULL) {
+                return;
+        }
+
+        for (l = notifications; l != NULL; l = l->next) {
+                _nd_queue_add (queue, ND_NOTIFICATION (l->data));
+        }
+
+        /* only notify once for the whole list */
         g_signal_emit (queue, signals[CHANGED], 0);
 
         queue_update (queue);
@@ -1013,3 +1381,91 @@ nd_queue_new (void)
 
         return ND_QUEUE (queue_object);
 }
+
+static gboolean
+prewarm_idle (NdQueue *queue)
+{
+        GdkScreen    *screen;
+        NotifyScreen *nscreen;
+        GtkIconInfo  *info;
+        gint64        start;
+
+        queue->priv->prewarm_id = 0;
+
+        start = g_get_monotonic_time ();
+
+        screen = gdk_screen_get_default ();
+        nscreen = queue->priv->screens[gdk_screen_get_number (screen)];
+        if (nscreen->bubble_pool == NULL) {
+                NdBubble *bubble;
+
+                bubble = get_bubble (queue, screen);
+                nd_bubble_prewarm (bubble);
+                nscreen->bubble_pool = g_slist_prepend (nscreen->bubble_pool, bubble);
+        }
+
+        /* index the icon theme and load the status icon */
+        ensure_numerable_icon (queue);
+        info = gtk_icon_theme_lookup_icon (gtk_icon_theme_get_for_screen (screen),
+                                           "mail-message-new",
+                                           PREWARM_ICON_SIZE,
+                                           0);
+        if (info != NULL) {
+                GdkPixbuf *pixbuf;
+
+                pixbuf = gtk_icon_info_load_icon (info, NULL);
+                if (pixbuf != NULL) {
+                        g_object_unref (pixbuf);
+                }
+                gtk_icon_info_free (info);
+        }
+
+        queue->priv->prewarm_time = g_get_monotonic_time () - start;
+        queue->priv->prewarmed = TRUE;
+        g_debug ("Prewarmed in %" G_GINT64_FORMAT " us", queue->priv->prewarm_time);
+
+        return FALSE;
+}
+
+/* Does the work the first notification would otherwise pay for, once
+ * the main loop has nothing else to do. */
+void
+nd_queue_prewarm (NdQueue *queue)
+{
+        g_return_if_fail (ND_IS_QUEUE (queue));
+
+        if (queue->priv->prewarmed || queue->priv->prewarm_id != 0) {
+                return;
+        }
+
+        queue->priv->prewarm_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                   (GSourceFunc) prewarm_idle,
+                                                   queue,
+                                                   NULL);
+}
+
+/* The first paint times are -1 until measured; the cold one is only
+ * measured when the daemon runs with --no-prewarm. */
+GVariant *
+nd_queue_get_stats (NdQueue *queue)
+{
+        GVariantBuilder builder;
+        guint           n_pooled;
+        int             i;
+
+        g_return_val_if_fail (ND_IS_QUEUE (queue), NULL);
+
+        n_pooled = 0;
+        for (i = 0; i < queue->priv->n_screens; i++) {
+                n_pooled += g_slist_length (queue->priv->screens[i]->bubble_pool);
+        }
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", "pooled", g_variant_new_uint32 (n_pooled));
+        g_variant_builder_add (&builder, "{sv}", "prewarmed", g_variant_new_boolean (queue->priv->prewarmed));
+        g_variant_builder_add (&builder, "{sv}", "prewarm-usec", g_variant_new_int64 (queue->priv->prewarm_time));
+        g_variant_builder_add (&builder, "{sv}", "cold-first-paint-usec", g_variant_new_int64 (queue->priv->cold_first_paint));
+        g_variant_builder_add (&builder, "{sv}", "warm-first-paint-usec", g_variant_new_int64 (queue->priv->warm_first_paint));
+
+        return g_variant_builder_end (&builder);
+}
@@ -57,11 +57,23 @@ guint               nd_queue_length                         (NdQueue        *que
 
 NdNotification *    nd_queue_lookup                         (NdQueue        *queue,
                                                              guint           id);
+NdNotification *    nd_queue_lookup_synchronous             (NdQueue        *queue,
+                                                             const char     *sender,
+                                                             const char     *tag);
 
 void                nd_queue_add                            (NdQueue        *queue,
                                                              NdNotification *notification);
+void                nd_queue_show_again                     (NdQueue        *queue,
+                                                             NdNotification *notification);
+void                nd_queue_add_list                       (NdQueue        *queue,
+                                                             GList          *notifications);
 void                nd_queue_remove_for_id                  (NdQueue        *queue,
                                                              guint           id);
+void                nd_queue_remove_for_sender              (NdQueue        *queue,
+                                                             const char     *sender);
+
+void                nd_queue_prewarm                        (NdQueue        *queue);
+GVariant *          nd_queue_get_stats                      (NdQueue        *queue);
 
 G_END_DECLS
 
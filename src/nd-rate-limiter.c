@@ -0,0 +1,246 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-rate-limiter.h"
+
+/* Once this many senders are tracked, the least recently used
+   buckets are dropped again when they have refilled completely, since
+   they carry no state anymore.  At ND_RATE_LIMITER_MAX_SENDERS the
+   least recently used bucket goes even when it is not full, so a flood
+   of new names can not grow the table without bound. */
+#define MAX_IDLE_BUCKETS 64
+
+/* Buckets are consumed from the GDBus worker thread and inspected
+   from the main thread. */
+G_LOCK_DEFINE_STATIC (buckets);
+
+typedef struct
+{
+        char  *sender;
+        double tokens;
+        gint64 last_refill;
+        GList  link;
+} Bucket;
+
+struct NdRateLimiter
+{
+        double      rate;
+        double      burst;
+        GHashTable *buckets;
+
+        /* most recently used bucket first */
+        GQueue      lru;
+};
+
+static void
+free_bucket (Bucket *bucket)
+{
+        g_free (bucket->sender);
+        g_free (bucket);
+}
+
+NdRateLimiter *
+nd_rate_limiter_new (double rate,
+                     guint  burst)
+{
+        NdRateLimiter *limiter;
+
+        limiter = g_new0 (NdRateLimiter, 1);
+        limiter->rate = rate;
+        limiter->burst = MAX (burst, 1);
+        limiter->buckets = g_hash_table_new_full (g_str_hash,
+                                                  g_str_equal,
+                                                  NULL,
+                                                  (GDestroyNotify) free_bucket);
+        g_queue_init (&limiter->lru);
+
+        return limiter;
+}
+
+void
+nd_rate_limiter_free (NdRateLimiter *limiter)
+{
+        if (limiter == NULL) {
+                return;
+        }
+
+        g_hash_table_destroy (limiter->buckets);
+        g_free (limiter);
+}
+
+static void
+refill_bucket (NdRateLimiter *limiter,
+               Bucket        *bucket,
+               gint64         now)
+{
+        double elapsed;
+
+        elapsed = (double) (now - bucket->last_refill) / G_USEC_PER_SEC;
+        bucket->tokens = MIN (limiter->burst,
+                              bucket->tokens + elapsed * limiter->rate);
+        bucket->last_refill = now;
+}
+
+static void
+remove_bucket (NdRateLimiter *limiter,
+               Bucket        *bucket)
+{
+        g_queue_unlink (&limiter->lru, &bucket->link);
+        g_hash_table_remove (limiter->buckets, bucket->sender);
+}
+
+/* Drops full buckets from the cold end of the LRU list, and makes
+   room for one more sender when the table is at its limit.  Every
+   bucket is dropped at most once, so this is O(1) amortized per
+   sender. */
+static void
+prune_buckets (NdRateLimiter *limiter,
+               gint64         now)
+{
+        while (g_hash_table_size (limiter->buckets) >= MAX_IDLE_BUCKETS) {
+                Bucket *bucket;
+
+                bucket = g_queue_peek_tail (&limiter->lru);
+                refill_bucket (limiter, bucket, now);
+                if (bucket->tokens < limiter->burst) {
+                        break;
+                }
+
+                remove_bucket (limiter, bucket);
+        }
+
+        while (g_hash_table_size (limiter->buckets) >= ND_RATE_LIMITER_MAX_SENDERS) {
+                Bucket *bucket;
+
+                bucket = g_queue_peek_tail (&limiter->lru);
+                g_debug ("Too many senders, forgetting %s", bucket->sender);
+                remove_bucket (limiter, bucket);
+        }
+}
+
+/* Takes n_tokens from the bucket of @sender.  Returns FALSE, leaving
+   the bucket untouched, when the sender does not have enough tokens
+   left.  No request costs more than a full bucket, so a NotifyBatch
+   larger than the burst is still admitted, and empties the bucket.
+   A rate of zero or less disables limiting. */
+gboolean
+nd_rate_limiter_consume (NdRateLimiter *limiter,
+                         const char    *sender,
+                         guint          n_tokens)
+{
+        Bucket *bucket;
+        double  tokens;
+        gint64  now;
+
+        g_return_val_if_fail (limiter != NULL, TRUE);
+
+        if (limiter->rate <= 0 || sender == NULL) {
+                return TRUE;
+        }
+
+        now = g_get_monotonic_time ();
+        tokens = MIN (n_tokens, limiter->burst);
+
+        G_LOCK (buckets);
+
+        bucket = g_hash_table_lookup (limiter->buckets, sender);
+        if (bucket == NULL) {
+                prune_buckets (limiter, now);
+
+                bucket = g_new0 (Bucket, 1);
+                bucket->sender = g_strdup (sender);
+                bucket->tokens = limiter->burst;
+                bucket->last_refill = now;
+                bucket->link.data = bucket;
+                g_hash_table_insert (limiter->buckets, bucket->sender, bucket);
+        } else {
+                refill_bucket (limiter, bucket, now);
+                g_queue_unlink (&limiter->lru, &bucket->link);
+        }
+        g_queue_push_head_link (&limiter->lru, &bucket->link);
+
+        if (bucket->tokens < tokens) {
+                g_debug ("Rate limiting %s: %.2f tokens left, %u requested",
+                         sender, bucket->tokens, n_tokens);
+                G_UNLOCK (buckets);
+                return FALSE;
+        }
+
+        bucket->tokens -= tokens;
+
+        G_UNLOCK (buckets);
+
+        return TRUE;
+}
+
+void
+nd_rate_limiter_forget (NdRateLimiter *limiter,
+                        const char    *sender)
+{
+        Bucket *bucket;
+
+        g_return_if_fail (limiter != NULL);
+
+        G_LOCK (buckets);
+        bucket = g_hash_table_lookup (limiter->buckets, sender);
+        if (bucket != NULL) {
+                remove_bucket (limiter, bucket);
+        }
+        G_UNLOCK (buckets);
+}
+
+/* Returns a floating a{sv} with the configuration and the current
+   token count of every tracked sender, for debugging. */
+GVariant *
+nd_rate_limiter_get_state (NdRateLimiter *limiter)
+{
+        GVariantBuilder builder;
+        GVariantBuilder buckets;
+        GHashTableIter  iter;
+        gpointer        key;
+        gpointer        value;
+        gint64          now;
+
+        g_return_val_if_fail (limiter != NULL, NULL);
+
+        now = g_get_monotonic_time ();
+
+        g_variant_builder_init (&buckets, G_VARIANT_TYPE ("a{sd}"));
+        G_LOCK (buckets);
+        g_hash_table_iter_init (&iter, limiter->buckets);
+        while (g_hash_table_iter_next (&iter, &key, &value)) {
+                Bucket *bucket = value;
+
+                refill_bucket (limiter, bucket, now);
+                g_variant_builder_add (&buckets, "{sd}", key, bucket->tokens);
+        }
+        G_UNLOCK (buckets);
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{sv}"));
+        g_variant_builder_add (&builder, "{sv}", "rate", g_variant_new_double (limiter->rate));
+        g_variant_builder_add (&builder, "{sv}", "burst", g_variant_new_double (limiter->burst));
+        g_variant_builder_add (&builder, "{sv}", "buckets", g_variant_builder_end (&buckets));
+
+        return g_variant_builder_end (&builder);
+}
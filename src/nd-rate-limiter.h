@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef __ND_RATE_LIMITER_H
+#define __ND_RATE_LIMITER_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct NdRateLimiter NdRateLimiter;
+
+/* the most senders tracked at once */
+#define ND_RATE_LIMITER_MAX_SENDERS 4096
+
+NdRateLimiter *     nd_rate_limiter_new                     (double         rate,
+                                                             guint          burst);
+void                nd_rate_limiter_free                    (NdRateLimiter *limiter);
+
+gboolean            nd_rate_limiter_consume                 (NdRateLimiter *limiter,
+                                                             const char    *sender,
+                                                             guint          n_tokens);
+void                nd_rate_limiter_forget                  (NdRateLimiter *limiter,
+                                                             const char    *sender);
+
+GVariant *          nd_rate_limiter_get_state               (NdRateLimiter *limiter);
+
+G_END_DECLS
+
+#endif /* __ND_RATE_LIMITER_H */
@@ -439,12 +439,14 @@ nd_stack_add_bubble (NdStack  *stack,
                                       req.height + NOTIFY_STACK_SPACING,
                                       &x,
                                       &y);
-        gtk_widget_show (GTK_WIDGET (bubble));
+        /* move first, a recycled bubble would otherwise flash at
+           its previous position */
         gtk_window_move (GTK_WINDOW (bubble), x, y);
+        gtk_widget_show (GTK_WIDGET (bubble));
 
         if (new_notification) {
                 g_signal_connect_swapped (G_OBJECT (bubble),
-                                          "destroy",
+                                          "dismissed",
                                           G_CALLBACK (nd_stack_remove_bubble),
                                           stack);
                 stack->priv->bubbles = g_list_prepend (stack->priv->bubbles, bubble);
@@ -457,6 +459,10 @@ nd_stack_remove_bubble (NdStack  *stack,
 {
         GList *remove_l = NULL;
 
+        g_signal_handlers_disconnect_by_func (bubble,
+                                              G_CALLBACK (nd_stack_remove_bubble),
+                                              stack);
+
         nd_stack_shift_notifications (stack,
                                       bubble,
                                       &remove_l,
@@ -467,9 +473,6 @@ nd_stack_remove_bubble (NdStack  *stack,
 
         if (remove_l != NULL)
                 stack->priv->bubbles = g_list_delete_link (stack->priv->bubbles, remove_l);
-
-        if (gtk_widget_get_realized (GTK_WIDGET (bubble)))
-                gtk_widget_unrealize (GTK_WIDGET (bubble));
 }
 
 void
@@ -478,6 +481,6 @@ nd_stack_remove_all (NdStack  *stack)
         GList *bubbles;
 
         bubbles = g_list_copy (stack->priv->bubbles);
-        g_list_foreach (bubbles, (GFunc)gtk_widget_destroy, NULL);
+        g_list_foreach (bubbles, (GFunc)nd_bubble_dismiss, NULL);
         g_list_free (bubbles);
 }
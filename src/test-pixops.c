@@ -0,0 +1,381 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <cairo.h>
+
+#include "nd-pixops.h"
+
+/* The vectorized loops handle 4 or 16 bytes at a time and leave the
+ * rest of a row to the scalar code, so the sizes are odd to cover both,
+ * and alpha is often one of the values where rounding goes wrong. */
+
+static const int widths[] = { 1, 3, 5, 7, 15, 17, 33, 101 };
+static const int heights[] = { 1, 3, 9, 31 };
+static const guchar edge_alphas[] = { 0, 1, 127, 128, 254, 255 };
+
+static guchar
+random_alpha (void)
+{
+        if (g_test_rand_bit ()) {
+                return edge_alphas[g_test_rand_int_range (0, G_N_ELEMENTS (edge_alphas))];
+        }
+
+        return g_test_rand_int_range (0, 256);
+}
+
+static GdkPixbuf *
+random_pixbuf (int      width,
+               int      height,
+               gboolean has_alpha,
+               gboolean opaque)
+{
+        GdkPixbuf *pixbuf;
+        guchar    *pixels;
+        int        rowstride;
+        int        n_channels;
+        int        x;
+        int        y;
+
+        pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, has_alpha, 8, width, height);
+        pixels = gdk_pixbuf_get_pixels (pixbuf);
+        rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+        n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+
+        for (y = 0; y < height; y++) {
+                guchar *p = pixels + y * rowstride;
+
+                for (x = 0; x < width; x++) {
+                        p[0] = g_test_rand_int_range (0, 256);
+                        p[1] = g_test_rand_int_range (0, 256);
+                        p[2] = g_test_rand_int_range (0, 256);
+                        if (has_alpha) {
+                                p[3] = opaque ? 255 : random_alpha ();
+                        }
+                        p += n_channels;
+                }
+        }
+
+        return pixbuf;
+}
+
+static void
+assert_pixbufs_equal (GdkPixbuf *a,
+                      GdkPixbuf *b)
+{
+        int width;
+        int height;
+        int y;
+
+        width = gdk_pixbuf_get_width (a);
+        height = gdk_pixbuf_get_height (a);
+
+        g_assert_cmpint (gdk_pixbuf_get_width (b), ==, width);
+        g_assert_cmpint (gdk_pixbuf_get_height (b), ==, height);
+        g_assert_cmpint (gdk_pixbuf_get_n_channels (b), ==, gdk_pixbuf_get_n_channels (a));
+
+        for (y = 0; y < height; y++) {
+                g_assert (memcmp (gdk_pixbuf_get_pixels (a) + y * gdk_pixbuf_get_rowstride (a),
+                                  gdk_pixbuf_get_pixels (b) + y * gdk_pixbuf_get_rowstride (b),
+                                  width * gdk_pixbuf_get_n_channels (a)) == 0);
+        }
+}
+
+static void
+assert_surfaces_equal (cairo_surface_t *a,
+                       cairo_surface_t *b)
+{
+        int width;
+        int height;
+        int y;
+
+        width = cairo_image_surface_get_width (a);
+        height = cairo_image_surface_get_height (a);
+
+        g_assert_cmpint (cairo_image_surface_get_format (b), ==, cairo_image_surface_get_format (a));
+        g_assert_cmpint (cairo_image_surface_get_width (b), ==, width);
+        g_assert_cmpint (cairo_image_surface_get_height (b), ==, height);
+
+        for (y = 0; y < height; y++) {
+                g_assert (memcmp (cairo_image_surface_get_data (a) + y * cairo_image_surface_get_stride (a),
+                                  cairo_image_surface_get_data (b) + y * cairo_image_surface_get_stride (b),
+                                  width * 4) == 0);
+        }
+}
+
+static void
+test_scale_down (void)
+{
+        guint i;
+        guint j;
+        int   has_alpha;
+
+        for (has_alpha = 0; has_alpha <= 1; has_alpha++) {
+                for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+                        for (j = 0; j < G_N_ELEMENTS (heights); j++) {
+                                GdkPixbuf       *src;
+                                cairo_surface_t *simd;
+                                cairo_surface_t *scalar;
+                                int              dest_width;
+                                int              dest_height;
+
+                                src = random_pixbuf (widths[i], heights[j], has_alpha, FALSE);
+                                dest_width = MAX (1, widths[i] / 3);
+                                dest_height = MAX (1, heights[j] / 2);
+
+                                _nd_pixops_set_simd_enabled (TRUE);
+                                simd = nd_pixops_scale_down (src, dest_width, dest_height);
+                                _nd_pixops_set_simd_enabled (FALSE);
+                                scalar = nd_pixops_scale_down (src, dest_width, dest_height);
+
+                                assert_surfaces_equal (simd, scalar);
+
+                                g_object_unref (src);
+                                cairo_surface_destroy (simd);
+                                cairo_surface_destroy (scalar);
+                        }
+                }
+        }
+
+        _nd_pixops_set_simd_enabled (TRUE);
+}
+
+static void
+assert_pixel (cairo_surface_t *surface,
+              int              x,
+              int              y,
+              guint32          expected)
+{
+        const guint32 *p;
+
+        p = (const guint32 *) (cairo_image_surface_get_data (surface)
+                               + y * cairo_image_surface_get_stride (surface)) + x;
+
+        g_assert_cmphex (*p, ==, expected);
+}
+
+/* The comparison with the scalar code does not catch a mistake both
+ * share, so these have known results, with and without SIMD. */
+
+static void
+test_scale_down_uniform (void)
+{
+        /* (12, 200, 77) at alpha 190, premultiplied */
+        static const guint32 premultiplied = 0xbe099539;
+        int                  simd;
+        int                  kind;
+
+        for (simd = 0; simd <= 1; simd++) {
+                _nd_pixops_set_simd_enabled (simd);
+
+                /* RGB, opaque RGBA and translucent RGBA */
+                for (kind = 0; kind < 3; kind++) {
+                        GdkPixbuf       *src;
+                        cairo_surface_t *dest;
+                        int              x;
+                        int              y;
+
+                        src = gdk_pixbuf_new (GDK_COLORSPACE_RGB, kind > 0, 8, 37, 23);
+                        gdk_pixbuf_fill (src, kind == 2 ? 0x0cc84dbe : 0x0cc84dff);
+
+                        dest = nd_pixops_scale_down (src, 5, 4);
+
+                        g_assert_cmpint (cairo_image_surface_get_format (dest),
+                                         ==,
+                                         kind == 2 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24);
+                        for (y = 0; y < 4; y++) {
+                                for (x = 0; x < 5; x++) {
+                                        assert_pixel (dest, x, y,
+                                                      kind == 2 ? premultiplied : 0xff0cc84d);
+                                }
+                        }
+
+                        g_object_unref (src);
+                        cairo_surface_destroy (dest);
+                }
+        }
+
+        _nd_pixops_set_simd_enabled (TRUE);
+}
+
+static void
+test_scale_down_alpha (void)
+{
+        /* opaque red and blue over transparent white, the white must
+           not show in the average, which is (128, 0, 128) at alpha
+           128, premultiplied */
+        static const guchar block[2][8] = {
+                { 255, 0, 0, 255,    255, 255, 255, 0 },
+                { 255, 255, 255, 0,  0, 0, 255, 255 }
+        };
+        int                 simd;
+
+        for (simd = 0; simd <= 1; simd++) {
+                GdkPixbuf       *src;
+                cairo_surface_t *dest;
+                guchar          *pixels;
+                int              rowstride;
+                int              x;
+                int              y;
+
+                _nd_pixops_set_simd_enabled (simd);
+
+                /* four 2x2 blocks side by side, wide enough for the
+                   vectorized loop */
+                src = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, 8, 2);
+                pixels = gdk_pixbuf_get_pixels (src);
+                rowstride = gdk_pixbuf_get_rowstride (src);
+                for (y = 0; y < 2; y++) {
+                        for (x = 0; x < 4; x++) {
+                                memcpy (pixels + y * rowstride + x * 8, block[y], 8);
+                        }
+                }
+
+                dest = nd_pixops_scale_down (src, 4, 1);
+                for (x = 0; x < 4; x++) {
+                        assert_pixel (dest, x, 0, 0x80400040);
+                }
+                cairo_surface_destroy (dest);
+
+                /* a block without any coverage stays transparent */
+                gdk_pixbuf_fill (src, 0xffffff00);
+                dest = nd_pixops_scale_down (src, 1, 1);
+                assert_pixel (dest, 0, 0, 0);
+                cairo_surface_destroy (dest);
+
+                g_object_unref (src);
+        }
+
+        _nd_pixops_set_simd_enabled (TRUE);
+}
+
+static void
+test_surface_from_pixbuf (void)
+{
+        guint i;
+        guint j;
+        int   kind;
+
+        /* RGB, opaque RGBA and translucent RGBA */
+        for (kind = 0; kind < 3; kind++) {
+                for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+                        for (j = 0; j < G_N_ELEMENTS (heights); j++) {
+                                GdkPixbuf       *src;
+                                cairo_surface_t *simd;
+                                cairo_surface_t *scalar;
+
+                                src = random_pixbuf (widths[i], heights[j], kind > 0, kind == 1);
+
+                                _nd_pixops_set_simd_enabled (TRUE);
+                                simd = nd_pixops_surface_from_pixbuf (src);
+                                _nd_pixops_set_simd_enabled (FALSE);
+                                scalar = nd_pixops_surface_from_pixbuf (src);
+
+                                g_assert_cmpint (cairo_image_surface_get_format (simd),
+                                                 ==,
+                                                 kind == 2 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24);
+                                assert_surfaces_equal (simd, scalar);
+
+                                g_object_unref (src);
+                                cairo_surface_destroy (simd);
+                                cairo_surface_destroy (scalar);
+                        }
+                }
+        }
+
+        _nd_pixops_set_simd_enabled (TRUE);
+}
+
+static void
+test_pixbuf_from_data (void)
+{
+        /* around the points where v / 257 rounds up and where v + 128
+           no longer fits in 16 bits */
+        static const guint16 edge_samples[] = { 0, 128, 129, 385, 0x7f7f, 0xff7f, 0xff80, 0xffff };
+        guint                i;
+        guint                j;
+        int                  n_channels;
+
+        for (n_channels = 1; n_channels <= 4; n_channels++) {
+                for (i = 0; i < G_N_ELEMENTS (widths); i++) {
+                        for (j = 0; j < G_N_ELEMENTS (heights); j++) {
+                                GdkPixbuf *simd;
+                                GdkPixbuf *scalar;
+                                guint16   *data;
+                                int        width;
+                                int        height;
+                                int        rowstride;
+                                int        k;
+
+                                width = widths[i];
+                                height = heights[j];
+
+                                /* padded, and so not aligned either */
+                                rowstride = (width * n_channels + 1) * 2;
+                                data = g_new (guint16, rowstride / 2 * height);
+
+                                for (k = 0; k < rowstride / 2 * height; k++) {
+                                        if (g_test_rand_bit ()) {
+                                                data[k] = edge_samples[g_test_rand_int_range (0, G_N_ELEMENTS (edge_samples))];
+                                        } else {
+                                                data[k] = g_test_rand_int_range (0, 0x10000);
+                                        }
+                                }
+
+                                _nd_pixops_set_simd_enabled (TRUE);
+                                simd = nd_pixops_pixbuf_from_data ((const guchar *) data,
+                                                                   width, height, rowstride,
+                                                                   n_channels, 16);
+                                _nd_pixops_set_simd_enabled (FALSE);
+                                scalar = nd_pixops_pixbuf_from_data ((const guchar *) data,
+                                                                     width, height, rowstride,
+                                                                     n_channels, 16);
+
+                                assert_pixbufs_equal (simd, scalar);
+
+                                g_free (data);
+                                g_object_unref (simd);
+                                g_object_unref (scalar);
+                        }
+                }
+        }
+
+        _nd_pixops_set_simd_enabled (TRUE);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_type_init ();
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/pixops/scale-down", test_scale_down);
+        g_test_add_func ("/pixops/scale-down-uniform", test_scale_down_uniform);
+        g_test_add_func ("/pixops/scale-down-alpha", test_scale_down_alpha);
+        g_test_add_func ("/pixops/surface-from-pixbuf", test_surface_from_pixbuf);
+        g_test_add_func ("/pixops/pixbuf-from-data", test_pixbuf_from_data);
+
+        return g_test_run ();
+}
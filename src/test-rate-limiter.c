@@ -0,0 +1,146 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2010 Red Hat, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "nd-rate-limiter.h"
+
+/* slow enough that nothing refills while a test runs */
+#define RATE  0.001
+#define BURST 20
+
+static void
+test_single (void)
+{
+        NdRateLimiter *limiter;
+        int            i;
+
+        limiter = nd_rate_limiter_new (RATE, BURST);
+
+        for (i = 0; i < BURST; i++) {
+                g_assert (nd_rate_limiter_consume (limiter, ":1.1", 1));
+        }
+        g_assert (! nd_rate_limiter_consume (limiter, ":1.1", 1));
+
+        /* other senders have their own bucket */
+        g_assert (nd_rate_limiter_consume (limiter, ":1.2", 1));
+
+        nd_rate_limiter_free (limiter);
+}
+
+static void
+test_batch_larger_than_burst (void)
+{
+        NdRateLimiter *limiter;
+
+        limiter = nd_rate_limiter_new (RATE, BURST);
+
+        /* a full bucket admits a batch of any size, and is empty after */
+        g_assert (nd_rate_limiter_consume (limiter, ":1.1", 5 * BURST));
+        g_assert (! nd_rate_limiter_consume (limiter, ":1.1", 1));
+        g_assert (! nd_rate_limiter_consume (limiter, ":1.1", 5 * BURST));
+
+        /* a partly used bucket has to refill first */
+        g_assert (nd_rate_limiter_consume (limiter, ":1.2", 1));
+        g_assert (! nd_rate_limiter_consume (limiter, ":1.2", BURST + 1));
+
+        nd_rate_limiter_free (limiter);
+}
+
+static void
+test_forget (void)
+{
+        NdRateLimiter *limiter;
+
+        limiter = nd_rate_limiter_new (RATE, BURST);
+
+        g_assert (nd_rate_limiter_consume (limiter, ":1.1", BURST));
+        g_assert (! nd_rate_limiter_consume (limiter, ":1.1", 1));
+
+        nd_rate_limiter_forget (limiter, ":1.1");
+        g_assert (nd_rate_limiter_consume (limiter, ":1.1", 1));
+
+        nd_rate_limiter_free (limiter);
+}
+
+static guint
+count_senders (NdRateLimiter *limiter)
+{
+        GVariant *state;
+        GVariant *buckets;
+        guint     n;
+
+        state = g_variant_ref_sink (nd_rate_limiter_get_state (limiter));
+        buckets = g_variant_lookup_value (state, "buckets", G_VARIANT_TYPE ("a{sd}"));
+        n = g_variant_n_children (buckets);
+        g_variant_unref (buckets);
+        g_variant_unref (state);
+
+        return n;
+}
+
+static void
+test_many_senders (void)
+{
+        NdRateLimiter *limiter;
+        char          *sender;
+        int            n_senders;
+        int            i;
+
+        limiter = nd_rate_limiter_new (RATE, BURST);
+        n_senders = ND_RATE_LIMITER_MAX_SENDERS + 100;
+
+        /* drained buckets are only dropped at the limit */
+        for (i = 0; i < n_senders; i++) {
+                sender = g_strdup_printf (":1.%d", i);
+                g_assert (nd_rate_limiter_consume (limiter, sender, BURST));
+                g_free (sender);
+        }
+
+        g_assert_cmpuint (count_senders (limiter), ==, ND_RATE_LIMITER_MAX_SENDERS);
+
+        /* the recent ones are still drained */
+        for (i = n_senders - 100; i < n_senders; i++) {
+                sender = g_strdup_printf (":1.%d", i);
+                g_assert (! nd_rate_limiter_consume (limiter, sender, 1));
+                g_free (sender);
+        }
+
+        /* the least recently used one was forgotten */
+        g_assert (nd_rate_limiter_consume (limiter, ":1.0", 1));
+        g_assert_cmpuint (count_senders (limiter), ==, ND_RATE_LIMITER_MAX_SENDERS);
+
+        nd_rate_limiter_free (limiter);
+}
+
+int
+main (int argc, char **argv)
+{
+        g_test_init (&argc, &argv, NULL);
+
+        g_test_add_func ("/rate-limiter/single", test_single);
+        g_test_add_func ("/rate-limiter/batch-larger-than-burst", test_batch_larger_than_burst);
+        g_test_add_func ("/rate-limiter/forget", test_forget);
+        g_test_add_func ("/rate-limiter/many-senders", test_many_senders);
+
+        return g_test_run ();
+}